@@ -0,0 +1,578 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "avl.h"
+#include "avl_pool.h"
+
+/* --- MACROS --------------------------------------- */
+
+#define arr_len(arr) (sizeof(arr) / sizeof(arr[0]))
+
+#define NODES_COUNT	2000000
+#define BENCH_REPEAT	3
+
+/* --- TYPEDEFS ------------------------------------- */
+
+typedef struct {
+	long num;
+	avl_node_t dict_data;
+} dict_item_t;
+
+AVL_DEFINE_ROOT(dict_t, dict_item_t);
+
+typedef struct {
+	long id;
+	avl_interval_node_t dict_data;
+} range_item_t;
+
+AVL_DEFINE_ROOT(range_dict_t, range_item_t);
+
+typedef struct {
+	long num;
+	avl_lean_node_t dict_data;
+} lean_item_t;
+
+AVL_DEFINE_LEAN_ROOT(lean_dict_t, lean_item_t);
+
+/* in-memory stream for avl_serialize and avl_deserialize, which also hands out
+ * the items for decoding */
+typedef struct {
+	unsigned char *data;
+	size_t size, capacity, pos;
+	dict_item_t *items;
+	size_t items_count;
+} stream_t;
+
+typedef void (*bench_func)(dict_item_t[]);
+
+typedef struct {
+	bench_func bench;
+	char *msg;
+} benchctx_t;
+
+/* --- HELPER FUNCTIONS ------------------------------ */
+
+int comparator(const void *node1, const void *node2) {
+	long num1 = ((dict_item_t *)node1)->num, num2 = ((dict_item_t *)node2)->num;
+	return (num1 == num2) ? 0
+			      : (num1 < num2) ? -1 : +1;
+}
+
+/* comparator which counts its calls */
+unsigned long comparisons;
+
+int counting_comparator(const void *node1, const void *node2) {
+	++comparisons;
+	return comparator(node1, node2);
+}
+
+int lean_comparator(const void *node1, const void *node2) {
+	long num1 = ((lean_item_t *)node1)->num, num2 = ((lean_item_t *)node2)->num;
+	return (num1 == num2) ? 0
+			      : (num1 < num2) ? -1 : +1;
+}
+
+/* orders ranges by their low endpoints and then by ids */
+int range_comparator(const void *item1, const void *item2) {
+	const range_item_t *range1 = item1, *range2 = item2;
+	if (range1->dict_data.low != range2->dict_data.low)
+		return (range1->dict_data.low < range2->dict_data.low) ? -1 : +1;
+	return (range1->id == range2->id) ? 0
+					  : (range1->id < range2->id) ? -1 : +1;
+}
+
+void *safe_malloc(size_t size) {
+	void *memory = malloc(size);
+	if (memory == NULL) {
+		fprintf(stderr, "couldn't allocate memory - exiting...\n");
+		exit(1);
+	}
+	return memory;
+}
+
+double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+size_t encode_item(void *ctx, const void *item, void *buf, size_t size) {
+	(void)ctx;
+	if (sizeof(long) <= size)
+		memcpy(buf, &((const dict_item_t *)item)->num, sizeof(long));
+	return sizeof(long);
+}
+
+int write_stream(void *ctx, const void *data, size_t size) {
+	stream_t *stream = ctx;
+	if (stream->size + size > stream->capacity) {
+		stream->capacity = (stream->size + size) * 2;
+		stream->data = realloc(stream->data, stream->capacity);
+		if (stream->data == NULL)
+			return -1;
+	}
+	memcpy(stream->data + stream->size, data, size);
+	stream->size += size;
+	return 0;
+}
+
+int read_stream(void *ctx, void *data, size_t size) {
+	stream_t *stream = ctx;
+	if (stream->pos + size > stream->size)
+		return -1;
+	memcpy(data, stream->data + stream->pos, size);
+	stream->pos += size;
+	return 0;
+}
+
+void *decode_item(void *ctx, const void *data, size_t size) {
+	stream_t *stream = ctx;
+	if (size != sizeof(long))
+		return NULL;
+	dict_item_t *item = &stream->items[stream->items_count++];
+	memcpy(&item->num, data, sizeof(long));
+	return item;
+}
+
+void fill_random(dict_item_t nodes[]) {
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		nodes[i].num = random();
+}
+
+void insert_all(dict_t *root, dict_item_t nodes[], size_t count) {
+	for (size_t i = 0; i < count; ++i)
+		avl_insert(root, &nodes[i]);
+}
+
+/* --- BENCHMARKS ----------------------------------- */
+
+void bench_verify(dict_item_t nodes[]) {
+	dict_t root = AVL_NEW(dict_t, dict_data, comparator);
+	fill_random(nodes);
+	insert_all(&root, nodes, NODES_COUNT);
+
+	double start = now_ms();
+	size_t count = 0;
+	avl_iterator_t iter = avl_get_iterator(&root, NULL, NULL);
+	while (avl_advance(&root, &iter) != NULL)
+		++count;
+	printf("\t%-28s%10.2f ms\n", "in-order iteration", now_ms() - start);
+
+	unsigned threads[] = { 1, 2, 4, 8, 0 };
+	for (size_t i = 0; i < arr_len(threads); ++i) {
+		avl_report_t report;
+		start = now_ms();
+		bool valid = avl_verify(&root, &report, threads[i]);
+		double took = now_ms() - start;
+		char label[32];
+		snprintf(label, sizeof(label), threads[i] ? "avl_verify, %u threads" : "avl_verify, default", threads[i]);
+		printf("\t%-28s%10.2f ms\t%s, height %d, %zu items\n", label, took, valid ? "valid" : "INVALID",
+		       report.height, report.count);
+	}
+}
+
+/* builds a tree of items from malloc or the pool, deletes three quarters of them
+ * and compares iteration over the sparse pool before and after compaction */
+void bench_pool(dict_item_t nodes[]) {
+	dict_t root = AVL_NEW(dict_t, dict_data, comparator);
+	dict_item_t **items = safe_malloc(NODES_COUNT * sizeof(dict_item_t *));
+	fill_random(nodes);
+
+	double start = now_ms();
+	for (size_t i = 0; i < NODES_COUNT; ++i) {
+		items[i] = safe_malloc(sizeof(dict_item_t));
+		items[i]->num = nodes[i].num;
+		free(avl_insert(&root, items[i]));
+	}
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		free(avl_delete(&root, items[i]));
+	printf("\t%-28s%10.2f ms\n", "malloc insert/delete", now_ms() - start);
+
+	avl_pool_t pool;
+	avl_pool_init(&pool, dict_t);
+	start = now_ms();
+	for (size_t i = 0; i < NODES_COUNT; ++i) {
+		items[i] = avl_pool_alloc(&pool);
+		items[i]->num = nodes[i].num;
+		avl_pool_free(&pool, avl_insert(&root, items[i]));
+	}
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		avl_pool_free(&pool, avl_delete(&root, items[i]));
+	printf("\t%-28s%10.2f ms\n", "pool insert/delete", now_ms() - start);
+
+	for (size_t i = 0; i < NODES_COUNT; ++i) {
+		items[i] = avl_pool_alloc(&pool);
+		items[i]->num = nodes[i].num;
+		avl_pool_free(&pool, avl_insert(&root, items[i]));
+	}
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		if (random() % 4 != 0)
+			avl_pool_free(&pool, avl_delete(&root, items[i]));
+
+	const char *labels[] = { "sparse pool iteration", "compacted pool iteration" };
+	for (size_t i = 0; i < arr_len(labels); ++i) {
+		if (i == 1) {
+			start = now_ms();
+			size_t freed = avl_pool_compact(&pool, &root);
+			printf("\t%-28s%10.2f ms\t%zu slabs freed\n", "compaction", now_ms() - start, freed);
+		}
+		start = now_ms();
+		long sum = 0;
+		avl_iterator_t iter = avl_get_iterator(&root, NULL, NULL);
+		for (dict_item_t *cur; (cur = avl_advance(&root, &iter));)
+			sum += cur->num;
+		printf("\t%-28s%10.2f ms\t(sum %ld)\n", labels[i], now_ms() - start, sum);
+	}
+
+	avl_pool_destroy(&pool);
+	free(items);
+}
+
+/* finds the ranges overlapping short windows by a linear scan, by the range
+ * iterator over all ranges starting before the window ends and by the overlap
+ * iterator */
+void bench_interval(dict_item_t nodes[]) {
+	(void)nodes;
+	const size_t queries = 100;
+	const long span = NODES_COUNT * 100L;
+	range_item_t *ranges = safe_malloc(NODES_COUNT * sizeof(range_item_t));
+	range_dict_t dict = AVL_NEW_INTERVAL(range_dict_t, dict_data, range_comparator);
+	for (size_t i = 0; i < NODES_COUNT; ++i) {
+		ranges[i].id = i;
+		ranges[i].dict_data.low = random() % span;
+		ranges[i].dict_data.high = ranges[i].dict_data.low + random() % ((i % 1000 == 0) ? span / 100 : 1000);
+		avl_insert(&dict, &ranges[i]);
+	}
+
+	long windows[queries];
+	for (size_t i = 0; i < queries; ++i)
+		windows[i] = random() % span;
+
+	size_t found = 0;
+	double start = now_ms();
+	for (size_t i = 0; i < queries; ++i)
+		for (size_t j = 0; j < NODES_COUNT; ++j)
+			found += ranges[j].dict_data.low <= windows[i] + 1000 && ranges[j].dict_data.high >= windows[i];
+	printf("\t%-28s%10.2f ms\t%zu overlaps\n", "linear scan", now_ms() - start, found);
+
+	found = 0;
+	start = now_ms();
+	for (size_t i = 0; i < queries; ++i) {
+		range_item_t bound = { .id = LONG_MAX, .dict_data.low = windows[i] + 1000 };
+		avl_iterator_t iter = avl_get_iterator(&dict, NULL, &bound);
+		for (range_item_t *cur; (cur = avl_advance(&dict, &iter));)
+			found += cur->dict_data.high >= windows[i];
+	}
+	printf("\t%-28s%10.2f ms\t%zu overlaps\n", "range iterator", now_ms() - start, found);
+
+	found = 0;
+	start = now_ms();
+	for (size_t i = 0; i < queries; ++i) {
+		avl_overlap_iterator_t iter = avl_overlap_iterate(&dict, windows[i], windows[i] + 1000);
+		while (avl_overlap_advance(&dict, &iter) != NULL)
+			++found;
+	}
+	printf("\t%-28s%10.2f ms\t%zu overlaps\n", "overlap iterator", now_ms() - start, found);
+	free(ranges);
+}
+
+/* compares the footprint and the speed of basic operations of trees with and
+ * without father pointers */
+void bench_lean(dict_item_t nodes[]) {
+	lean_item_t *lean_nodes = safe_malloc(NODES_COUNT * sizeof(lean_item_t));
+	dict_t root = AVL_NEW(dict_t, dict_data, comparator);
+	lean_dict_t lean = AVL_NEW_LEAN(lean_dict_t, dict_data, lean_comparator);
+	fill_random(nodes);
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		lean_nodes[i].num = nodes[i].num;
+
+	printf("\t%-8s%12s%12s%12s%12s%12s\n", "", "item bytes", "insert", "find", "iterate", "delete");
+	double took[4], start = now_ms();
+	insert_all(&root, nodes, NODES_COUNT);
+	took[0] = now_ms() - start;
+	start = now_ms();
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		avl_find(&root, &nodes[i]);
+	took[1] = now_ms() - start;
+	start = now_ms();
+	avl_iterator_t iter = avl_get_iterator(&root, NULL, NULL);
+	while (avl_advance(&root, &iter) != NULL)
+		;
+	took[2] = now_ms() - start;
+	start = now_ms();
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		avl_delete(&root, &nodes[i]);
+	took[3] = now_ms() - start;
+	printf("\t%-8s%12zu%9.2f ms%9.2f ms%9.2f ms%9.2f ms\n", "father", sizeof(dict_item_t), took[0], took[1],
+	       took[2], took[3]);
+
+	start = now_ms();
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		avl_lean_insert(&lean, &lean_nodes[i]);
+	took[0] = now_ms() - start;
+	start = now_ms();
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		avl_lean_find(&lean, &lean_nodes[i]);
+	took[1] = now_ms() - start;
+	start = now_ms();
+	avl_lean_iterator_t lean_iter = avl_lean_get_iterator(&lean, NULL, NULL);
+	while (avl_lean_advance(&lean, &lean_iter) != NULL)
+		;
+	took[2] = now_ms() - start;
+	start = now_ms();
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		avl_lean_delete(&lean, &lean_nodes[i]);
+	took[3] = now_ms() - start;
+	printf("\t%-8s%12zu%9.2f ms%9.2f ms%9.2f ms%9.2f ms\n", "lean", sizeof(lean_item_t), took[0], took[1],
+	       took[2], took[3]);
+	free(lean_nodes);
+}
+
+/* inserts a stream of items into an empty tree either plainly or with the
+ * previously inserted item as the hint */
+void hint_stream(const char *name, dict_item_t nodes[]) {
+	for (int hinted = 0; hinted < 2; ++hinted) {
+		dict_t root = AVL_NEW(dict_t, dict_data, counting_comparator);
+		dict_item_t *hint = NULL;
+		comparisons = 0;
+		double start = now_ms();
+		for (size_t i = 0; i < NODES_COUNT; ++i) {
+			if (hinted) {
+				/* the inserted item is in the tree even if it replaced another one */
+				avl_insert_hint(&root, &nodes[i], hint);
+				hint = &nodes[i];
+			} else {
+				avl_insert(&root, &nodes[i]);
+			}
+		}
+		printf("\t%-16s%-8s%10.2f ms%10.2f cmp/insert\n", name, hinted ? "hint" : "plain", now_ms() - start,
+		       (double)comparisons / NODES_COUNT);
+	}
+}
+
+void bench_hint(dict_item_t nodes[]) {
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		nodes[i].num = i;
+	hint_stream("sequential", nodes);
+
+	/* every item is at most 64 positions away from its place */
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		nodes[i].num = i * 64 + random() % 4096;
+	hint_stream("nearly sorted", nodes);
+
+	fill_random(nodes);
+	hint_stream("random", nodes);
+}
+
+/* rebuilds a tree from its serialized form by avl_deserialize and by
+ * inserting the decoded items one by one */
+void bench_serialize(dict_item_t nodes[]) {
+	dict_t root = AVL_NEW(dict_t, dict_data, comparator);
+	fill_random(nodes);
+	insert_all(&root, nodes, NODES_COUNT);
+	stream_t stream = { .items = safe_malloc(NODES_COUNT * sizeof(dict_item_t)) };
+	avl_report_t report;
+	/* keep the page faults of the fresh allocation out of the measurements */
+	memset(stream.items, 0, NODES_COUNT * sizeof(dict_item_t));
+
+	double start = now_ms();
+	avl_serialize(&root, encode_item, write_stream, &stream);
+	printf("\t%-28s%10.2f ms\t%zu bytes\n", "avl_serialize", now_ms() - start, stream.size);
+
+	dict_t copy = AVL_NEW(dict_t, dict_data, comparator);
+	start = now_ms();
+	avl_deserialize(&copy, read_stream, decode_item, NULL, &stream);
+	double took = now_ms() - start;
+	avl_verify(&copy, &report, 1);
+	printf("\t%-28s%10.2f ms\theight %d\n", "avl_deserialize", took, report.height);
+
+	/* the same stream decoded and inserted item by item */
+	copy = AVL_NEW(dict_t, dict_data, comparator);
+	stream.pos = stream.items_count = 0;
+	unsigned char header[4];
+	start = now_ms();
+	while (read_stream(&stream, header, 4) == 0) {
+		uint32_t count = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+		if (count == 0)
+			break;
+		for (; count > 0; --count) {
+			unsigned char buf[sizeof(long)];
+			if (read_stream(&stream, header, 4) != 0 || read_stream(&stream, buf, sizeof(buf)) != 0)
+				break;
+			avl_insert(&copy, decode_item(&stream, buf, sizeof(buf)));
+		}
+	}
+	took = now_ms() - start;
+	avl_verify(&copy, &report, 1);
+	printf("\t%-28s%10.2f ms\theight %d\n", "decode and avl_insert", took, report.height);
+
+	free(stream.items);
+	free(stream.data);
+}
+
+#ifdef AVL_STATS
+/* deletes a quarter of the items of a tree right away, by marking them and
+ * purging all tombstones at once and by marking them and purging in steps */
+void bench_tombstones(dict_item_t nodes[]) {
+	const size_t burst = NODES_COUNT / 4, budget = 1000;
+	fill_random(nodes);
+	for (int mode = 0; mode < 3; ++mode) {
+		dict_t root = AVL_NEW(dict_t, dict_data, comparator);
+		insert_all(&root, nodes, NODES_COUNT);
+
+		double start = now_ms(), slowest = 0;
+		for (size_t i = 0; i < burst; ++i) {
+			if (mode == 0)
+				avl_delete(&root, &nodes[i]);
+			else
+				avl_mark_deleted(&root, &nodes[i]);
+		}
+		double marked = now_ms() - start;
+		if (mode == 1) {
+			avl_purge(&root, NULL, NULL);
+			slowest = now_ms() - start - marked;
+		} else if (mode == 2) {
+			for (size_t left = 1; left > 0;) {
+				double step = now_ms();
+				left = avl_purge(&root, NULL, NULL, budget);
+				step = now_ms() - step;
+				slowest = (step > slowest) ? step : slowest;
+			}
+		}
+		double took = now_ms() - start;
+
+		avl_report_t report;
+		avl_verify(&root, &report, 1);
+		const char *names[] = { "avl_delete", "mark + purge", "mark + purge 1000" };
+		printf("\t%-20s%10.2f ms%10.2f ms burst%10.3f ms slowest purge\theight %d\n", names[mode], took, marked,
+		       slowest, report.height);
+	}
+}
+
+/* time to look up all the items in the order of the array */
+double lookups(dict_t *root, dict_item_t nodes[]) {
+	double start = now_ms();
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		avl_find(root, &nodes[i]);
+	return now_ms() - start;
+}
+
+/* a tree left by deleting every other item rebuilt step by step in place and
+ * into a buffer in both layouts */
+void bench_rebuild(dict_item_t nodes[]) {
+	const size_t budget = 256;
+	dict_item_t *buffer = safe_malloc(NODES_COUNT * sizeof(dict_item_t));
+	fill_random(nodes);
+	for (int mode = 0; mode < 3; ++mode) {
+		dict_t root = AVL_NEW(dict_t, dict_data, comparator);
+		insert_all(&root, nodes, NODES_COUNT);
+		for (size_t i = 1; i < NODES_COUNT; i += 2)
+			avl_delete(&root, &nodes[i]);
+
+		avl_report_t report;
+		avl_verify(&root, &report, 1);
+		int height = report.height;
+		double before = lookups(&root, nodes);
+
+		avl_layout_t layout = { buffer, NODES_COUNT, (mode == 1) ? AVL_LAYOUT_INORDER : AVL_LAYOUT_VEB, NULL, NULL };
+		double start = now_ms(), slowest = 0;
+		for (size_t left = 1; left > 0;) {
+			double step = now_ms();
+			left = avl_rebuild_step(&root, budget, (mode == 0) ? NULL : &layout);
+			step = now_ms() - step;
+			slowest = (step > slowest) ? step : slowest;
+		}
+		double took = now_ms() - start;
+
+		avl_verify(&root, &report, 1);
+		const char *names[] = { "in place", "in-order", "van Emde Boas" };
+		printf("\t%-15s%10.2f ms%10.3f ms slowest step\theight %d -> %d\tlookups %.2f -> %.2f ms\n",
+		       names[mode], took, slowest, height, report.height, before, lookups(&root, nodes));
+	}
+	free(buffer);
+}
+
+/* a stream of alternating inserts of new items and deletes of random present
+ * items on a tree prefilled with half of the items */
+void churn(avl_policy_t policy, const char *name, dict_item_t nodes[]) {
+	dict_t root = AVL_NEW(dict_t, dict_data, comparator, policy);
+	size_t *present = safe_malloc(NODES_COUNT * sizeof(size_t));
+	size_t present_count = 0;
+
+	fill_random(nodes);
+	for (size_t i = 0; i < NODES_COUNT / 2; ++i)
+		if (avl_insert(&root, &nodes[i]) == NULL)
+			present[present_count++] = i;
+
+	unsigned long insert_rotations = 0, delete_rotations = 0, max_delete_rotations = 0;
+	double start = now_ms();
+	for (size_t i = NODES_COUNT / 2; i < NODES_COUNT; ++i) {
+		unsigned long before = avl_stats_rotations;
+		if (avl_insert(&root, &nodes[i]) == NULL)
+			present[present_count++] = i;
+		insert_rotations += avl_stats_rotations - before;
+
+		size_t victim = random() % present_count;
+		before = avl_stats_rotations;
+		avl_delete(&root, &nodes[present[victim]]);
+		present[victim] = present[--present_count];
+		unsigned long rotations = avl_stats_rotations - before;
+		delete_rotations += rotations;
+		max_delete_rotations = (rotations > max_delete_rotations) ? rotations : max_delete_rotations;
+	}
+	double took = now_ms() - start;
+
+	avl_report_t report;
+	avl_verify(&root, &report, 1);
+	size_t ops = NODES_COUNT / 2;
+	printf("\t%-6s%10.2f ms%12.3f%12.3f%12lu%10d\n", name, took, (double)insert_rotations / ops,
+	       (double)delete_rotations / ops, max_delete_rotations, report.height);
+	free(present);
+}
+
+void bench_churn(dict_item_t nodes[]) {
+	printf("\t%-6s%13s%12s%12s%12s%10s\n", "", "time", "rot/insert", "rot/delete", "max/delete", "height");
+	churn(AVL_POLICY_AVL, "AVL", nodes);
+	churn(AVL_POLICY_WAVL, "WAVL", nodes);
+}
+#endif
+
+/* --- BENCHMARK INFRASTRUCTURE --------------------- */
+
+int main(int argc, char *argv[]) {
+	srandom(time(NULL));
+	dict_item_t *nodes = safe_malloc(NODES_COUNT * sizeof(dict_item_t));
+
+	benchctx_t ctxs[] = {
+		{ .bench = bench_verify,    .msg = "verify" },
+		{ .bench = bench_pool,      .msg = "pool" },
+		{ .bench = bench_interval,  .msg = "interval" },
+		{ .bench = bench_lean,      .msg = "lean" },
+		{ .bench = bench_hint,      .msg = "hint" },
+		{ .bench = bench_serialize, .msg = "serialize" },
+		{ .bench = bench_tombstones, .msg = "tombstones" },
+		{ .bench = bench_rebuild,   .msg = "rebuild" },
+#ifdef AVL_STATS
+		{ .bench = bench_churn,     .msg = "churn" },
+#endif
+	};
+
+	/* run only the benchmarks named on the command line, or all of them */
+	for (size_t i = 0; i < arr_len(ctxs); ++i) {
+		bool selected = (argc == 1);
+		for (int j = 1; j < argc; ++j)
+			selected |= (strcmp(argv[j], ctxs[i].msg) == 0);
+		if (!selected)
+			continue;
+		printf("%s (%d items)\n", ctxs[i].msg, NODES_COUNT);
+		for (int j = 0; j < BENCH_REPEAT; ++j)
+			ctxs[i].bench(nodes);
+	}
+
+	free(nodes);
+	return 0;
+}
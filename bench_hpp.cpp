@@ -0,0 +1,183 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <set>
+#include <vector>
+
+#include <boost/intrusive/avl_set.hpp>
+
+#include "avl.hpp"
+
+/* compares avl::tree against the C interface, std::set and boost::intrusive::avl_set
+ * on the workloads of test.c */
+
+/* --- MACROS --------------------------------------- */
+
+#define NODES_COUNT	500000
+#define BENCH_REPEAT	5
+
+/* --- TYPEDEFS ------------------------------------- */
+
+struct dict_item_t {
+	long num;
+	avl_node_t dict_data;
+	boost::intrusive::avl_set_member_hook<> boost_hook;
+
+	friend bool operator<(const dict_item_t &a, const dict_item_t &b) { return a.num < b.num; }
+};
+
+using cpp_tree_t   = avl::tree<dict_item_t, &dict_item_t::dict_data>;
+using boost_tree_t = boost::intrusive::avl_set<dict_item_t,
+	boost::intrusive::member_hook<dict_item_t, boost::intrusive::avl_set_member_hook<>, &dict_item_t::boost_hook>>;
+
+/* --- HELPER FUNCTIONS ------------------------------ */
+
+extern "C" int comparator(const void *node1, const void *node2) {
+	long num1 = ((const dict_item_t *)node1)->num, num2 = ((const dict_item_t *)node2)->num;
+	return (num1 == num2) ? 0
+			      : (num1 < num2) ? -1 : +1;
+}
+
+/* keeps the optimizer from throwing away benchmarked lookups */
+static volatile long sink;
+
+template <typename F>
+double measure(F &&func) {
+	double best = 1e300;
+	for (int i = 0; i < BENCH_REPEAT; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		func();
+		std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+		best = (took.count() < best) ? took.count() : best;
+	}
+	return best;
+}
+
+/* --- WORKLOADS ------------------------------------ */
+
+struct results {
+	double insert_random, insert_linear, find, iterate, remove;
+};
+
+/* the generic macros of avl.h rely on C only extensions, so the C interface is
+ * driven through the *_impl functions here */
+results bench_c(std::vector<dict_item_t> &random_nodes, std::vector<dict_item_t> &linear_nodes) {
+	results out;
+	avl_root_t root{};
+	auto insert_all = [&](std::vector<dict_item_t> &nodes) {
+		root = avl_root_t{};
+		root.cmp = comparator;
+		root.offset = offsetof(dict_item_t, dict_data);
+		for (auto &node : nodes)
+			avl_insert_impl(&node.dict_data, &root);
+	};
+
+	out.insert_linear = measure([&] { insert_all(linear_nodes); });
+	out.insert_random = measure([&] { insert_all(random_nodes); });
+	out.find = measure([&] {
+		for (auto &node : random_nodes)
+			sink = avl_find_impl(&node.dict_data, &root) != nullptr;
+	});
+	out.iterate = measure([&] {
+		avl_iterator_t iter = avl_get_iterator_impl(&root, nullptr, nullptr, AVL_ASCENDING);
+		for (avl_node_t *cur; (cur = avl_advance_impl(&iter));)
+			sink = (long)cur;
+	});
+	out.remove = measure([&] {
+		insert_all(random_nodes);
+		for (auto &node : random_nodes)
+			avl_delete_impl(&node.dict_data, &root);
+	});
+	return out;
+}
+
+template <typename Tree, typename Insert, typename Erase>
+results bench_set(Tree &tree, std::vector<dict_item_t> &random_nodes, std::vector<dict_item_t> &linear_nodes,
+		  Insert insert, Erase erase) {
+	results out;
+	auto insert_all = [&](std::vector<dict_item_t> &nodes) {
+		tree.clear();
+		for (auto &node : nodes)
+			insert(node);
+	};
+
+	out.insert_linear = measure([&] { insert_all(linear_nodes); });
+	out.insert_random = measure([&] { insert_all(random_nodes); });
+	out.find = measure([&] {
+		for (auto &node : random_nodes)
+			sink = tree.find(node) != tree.end();
+	});
+	out.iterate = measure([&] {
+		for (auto &item : tree)
+			sink = item.num;
+	});
+	out.remove = measure([&] {
+		insert_all(random_nodes);
+		for (auto &node : random_nodes)
+			erase(node);
+	});
+	tree.clear();
+	return out;
+}
+
+void print(const char *name, const results &res) {
+	printf("%-26s%12.2f%12.2f%12.2f%12.2f%12.2f\n", name, res.insert_random, res.insert_linear, res.find,
+	       res.iterate, res.remove);
+}
+
+int main() {
+	srandom(time(nullptr));
+	std::vector<dict_item_t> random_nodes(NODES_COUNT), linear_nodes(NODES_COUNT);
+	for (std::size_t i = 0; i < NODES_COUNT; ++i) {
+		random_nodes[i].num = random();
+		linear_nodes[i].num = i;
+	}
+
+	printf("%zu items, best of %d runs, milliseconds\n\n", (std::size_t)NODES_COUNT, BENCH_REPEAT);
+	printf("%-26s%12s%12s%12s%12s%12s\n", "", "rnd insert", "lin insert", "find", "iterate", "remove");
+
+	print("avl C interface", bench_c(random_nodes, linear_nodes));
+
+	cpp_tree_t cpp_tree;
+	print("avl::tree", bench_set(cpp_tree, random_nodes, linear_nodes,
+				     [&](dict_item_t &node) { cpp_tree.insert(node); },
+				     [&](dict_item_t &node) { cpp_tree.erase_key(node); }));
+
+	boost_tree_t boost_tree;
+	print("boost::intrusive::avl_set", bench_set(boost_tree, random_nodes, linear_nodes,
+						     [&](dict_item_t &node) { boost_tree.insert(node); },
+						     [&](dict_item_t &node) { boost_tree.erase(node); }));
+
+	std::set<long> std_set;
+	std::vector<long> random_keys, linear_keys;
+	for (std::size_t i = 0; i < NODES_COUNT; ++i) {
+		random_keys.push_back(random_nodes[i].num);
+		linear_keys.push_back(linear_nodes[i].num);
+	}
+	results std_res;
+	auto insert_all = [&](std::vector<long> &keys) {
+		std_set.clear();
+		for (long key : keys)
+			std_set.insert(key);
+	};
+	std_res.insert_linear = measure([&] { insert_all(linear_keys); });
+	std_res.insert_random = measure([&] { insert_all(random_keys); });
+	std_res.find = measure([&] {
+		for (long key : random_keys)
+			sink = std_set.find(key) != std_set.end();
+	});
+	std_res.iterate = measure([&] {
+		for (long key : std_set)
+			sink = key;
+	});
+	std_res.remove = measure([&] {
+		insert_all(random_keys);
+		for (long key : random_keys)
+			std_set.erase(key);
+	});
+	print("std::set<long>", std_res);
+
+	return 0;
+}
@@ -1,3 +1,11 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "avl.h"
 
 /* --- MACROS ------------------------------------------------- */
@@ -15,6 +23,87 @@
 /* a readability measure - left & right serve as indicies into the sons member of avl_node_t */
 enum avl_son_index { left, right };
 
+/* trees lower than this are always verified by a single thread */
+#define VERIFY_PARALLEL_MIN_HEIGHT	20
+
+/* number of subtrees per thread the verification work is split into */
+#define VERIFY_TASKS_PER_THREAD		8
+
+/* number of items in a chunk written by avl_serialize */
+#define SERIALIZE_CHUNK_ITEMS		256
+
+/* initial size of the buffers of avl_serialize and avl_deserialize */
+#define SERIALIZE_BUFFER_SIZE		4096
+
+/* --- TYPES -------------------------------------------------- */
+
+/* state of a tree being built from nodes arriving in order
+ * the nodes on the stack wait for their right subtree, their left subtrees fill
+ * perfect trees of slots whose heights decrease towards the top of the stack
+ * and carry is the tree of the nodes following the top one - a slot is left
+ * empty only by build_skip, otherwise the trees are perfect */
+typedef struct {
+	avl_root_t *root;
+	struct {
+		avl_node_t *node;
+		int height; // height of the left subtree
+		int slots;  // height of the perfect tree of slots the left subtree fills
+	} stack[AVL_MAX_HEIGHT];
+	int depth;
+	avl_node_t *carry;
+	int carry_height, carry_slots;
+	avl_node_t *last;
+	size_t count;
+} build_ctx_t;
+
+/* state of a pass of avl_rebuild_step_impl - the nodes are split by their keys
+ * into three parts, lower is a valid tree of the nodes rebuilt before a write
+ * to the part being built closed it, build holds the part being built and
+ * upper is a valid tree of the nodes yet to be visited
+ * between the calls the parts are threaded into a single search tree for the
+ * lookups, every write unthreads them and works on the part of its key */
+struct avl_rebuild {
+	build_ctx_t build;
+	avl_node_t *lower, *upper;
+	avl_node_t *first;                   // first node of the part being built
+	avl_node_t *lower_tail, *carry_tail; // nodes whose right son is set by threading
+	size_t left;                         // number of nodes in upper
+	size_t visited;                      // number of nodes moved over from upper
+	size_t slots;                        // slots of the part being built taken so far
+	size_t closed_slots;                 // slots taken by the parts closed before
+	size_t leaves, holes;                // bottom slots of the part being built and how many stay empty
+	size_t spread;                       // spreads the holes evenly among the leaves
+	bool relocate;                       // layout is in use
+	avl_layout_t layout;
+	size_t item_size;
+	int veb_height; // height of the perfect tree the van Emde Boas order is computed for
+};
+
+/* a subtree verified by one of the threads of avl_verify_impl together with
+ * the in-order neighbours it is bounded by */
+typedef struct {
+	avl_node_t *node, *father, *lower, *upper;
+	int depth, height;
+	avl_violation_t violation;
+	avl_node_t *culprit;
+	size_t count, tombstones, signs[3];
+} verify_task_t;
+
+typedef struct {
+	avl_root_t *root;
+	verify_task_t *tasks;
+	size_t tasks_count;
+	atomic_size_t next_task;
+	atomic_bool failed; // lets the other threads stop early once a violation is found
+	avl_node_t *thread; // right son taken for an empty one, the link to the next part of a rebuild pass
+} verify_ctx_t;
+
+/* --- STATISTICS --------------------------------------------- */
+
+#ifdef AVL_STATS
+unsigned long avl_stats_rotations;
+#endif
+
 /* --- INTERNAL FUNCTIONS ------------------------------------- */
 
 /* a shortcut to compare two nodes via the user provided comparator function
@@ -27,23 +116,26 @@ static int compare_nodes(avl_root_t *root, avl_node_t *node1, avl_node_t *node2)
 	return root->cmp(AVL_UPCAST(node1, root->offset), AVL_UPCAST(node2, root->offset));
 }
 
-/* choose next node on the path to node with given key according to BST invariant */
-static avl_node_t **choose_son(avl_node_t *key_node, avl_node_t *node, avl_root_t *root) {
-	return (compare_nodes(root, key_node, node) < 0) ? &node->sons[left] : &node->sons[right];
-}
-
 /* returns true if node with given key was found otherwise false
+ * the search descends from the node start points to
  * out will point to father's pointer to node with given key if such exists
  * if it doesn't it will point to father's pointer to last node visited by the find operation */
-static bool avl_find_getaddr(avl_node_t *key_node, avl_root_t *root, avl_node_t ***out) {
-	avl_node_t **current_node, **current_son;
-	current_node = current_son = &root->root_node;
-	while (*current_son != NULL && compare_nodes(root, *current_node, key_node) != 0) {
-		current_node = current_son;
-		current_son  = choose_son(key_node, *current_node, root);
+static bool find_getaddr_from(avl_node_t **start, avl_node_t *key_node, avl_root_t *root, avl_node_t ***out) {
+	avl_node_t **current_node = start;
+	*out = start;
+	while (*current_node != NULL) {
+		int comparison = compare_nodes(root, key_node, *current_node);
+		*out = current_node;
+		if (comparison == 0)
+			return true;
+		current_node = &(*current_node)->sons[comparison > 0];
 	}
-	*out = current_node;
-	return *current_node != NULL && compare_nodes(root, *current_node, key_node) == 0;
+	return false;
+}
+
+/* find_getaddr_from starting at the root node */
+static bool avl_find_getaddr(avl_node_t *key_node, avl_root_t *root, avl_node_t ***out) {
+	return find_getaddr_from(&root->root_node, key_node, root, out);
 }
 
 /* used exclusively inside avl_delete - DO NOT USE ELSEWHERE
@@ -78,6 +170,30 @@ static avl_node_t **minmax_of_tree(avl_node_t **node, bool max) {
 	return node;
 }
 
+/* the interval node of node - only valid in trees in interval mode */
+static avl_interval_node_t *interval(avl_node_t *node) {
+	return (avl_interval_node_t *)node;
+}
+
+/* maximal high endpoint in a possibly empty subtree */
+static long subtree_max(avl_node_t *node) {
+	return (node == NULL) ? LONG_MIN : interval(node)->max;
+}
+
+/* maximal high endpoint of the subtree of node computed from its sons */
+static long compute_max(avl_node_t *node) {
+	long sons_max = MAX(subtree_max(node->sons[left]), subtree_max(node->sons[right]));
+	return MAX(interval(node)->high, sons_max);
+}
+
+/* recomputes the max endpoints on the path from node up to the root */
+static void update_max_path(avl_node_t *node, avl_root_t *root) {
+	if (!root->interval)
+		return;
+	for (; node != NULL; node = node->father)
+		interval(node)->max = compute_max(node);
+}
+
 /* edge rotation
  *     |           |
  *     y           x
@@ -87,23 +203,16 @@ static avl_node_t **minmax_of_tree(avl_node_t **node, bool max) {
  * A   B           B   C
  * it is presumed that x and y are non-null
  * x, y represent nodes while A, B, C represent (possibly empty) subtrees
- * arguments are named according to the left part of the diagram */
-static void rotate(avl_node_t **ynode, bool left_to_right) {
+ * arguments are named according to the left part of the diagram
+ * only the links and max endpoints are changed, balance information is left to the caller */
+static void rotate_links(avl_node_t **ynode, bool left_to_right, avl_root_t *root) {
 	avl_node_t **ptr_to_x = &(*ynode)->sons[!left_to_right];
 	avl_node_t *xnode = *ptr_to_x;
 	avl_node_t **bnode = &xnode->sons[left_to_right];
 
-	/* update signs */
-	int aheight, bheight;
-	aheight = bheight = (left_to_right ? -(*ynode)->sign : (*ynode)->sign) - 1;
-	if (xnode->sign < 0) {
-		bheight += xnode->sign;
-	} else {
-		aheight -= xnode->sign;
-	}
-	(*ynode)->sign = left_to_right ? -bheight : aheight;
-	xnode->sign    = left_to_right ?  MAX(bheight, 0) - aheight + 1
-				       : -MAX(aheight, 0) + bheight - 1;
+#ifdef AVL_STATS
+	++avl_stats_rotations;
+#endif
 
 	/* make b son of y */
 	if (*bnode != NULL)
@@ -115,6 +224,32 @@ static void rotate(avl_node_t **ynode, bool left_to_right) {
 	(*ynode)->father = xnode;
 	*bnode = *ynode;
 	*ynode = xnode;
+
+	/* x now spans the items y did before */
+	if (root->interval) {
+		interval(xnode)->max = interval(*bnode)->max;
+		interval(*bnode)->max = compute_max(*bnode);
+	}
+}
+
+/* updates the signs of y and x for the edge rotation of rotate_links */
+static void rotate_signs(int *ysign, int *xsign, bool left_to_right) {
+	int aheight, bheight;
+	aheight = bheight = (left_to_right ? -*ysign : *ysign) - 1;
+	if (*xsign < 0) {
+		bheight += *xsign;
+	} else {
+		aheight -= *xsign;
+	}
+	*ysign = left_to_right ? -bheight : aheight;
+	*xsign = left_to_right ?  MAX(bheight, 0) - aheight + 1
+			       : -MAX(aheight, 0) + bheight - 1;
+}
+
+/* edge rotation as in rotate_links which also updates the signs of x and y */
+static void rotate(avl_node_t **ynode, bool left_to_right, avl_root_t *root) {
+	rotate_signs(&(*ynode)->sign, &(*ynode)->sons[!left_to_right]->sign, left_to_right);
+	rotate_links(ynode, left_to_right, root);
 }
 
 /* get pointer to father's pointer to node */
@@ -144,8 +279,8 @@ static void balance(avl_node_t *node, avl_root_t *root, bool from_left, bool aft
 			avl_node_t **son = control ? &node->sons[right] : &node->sons[left];
 			int prevsign = (*son)->sign;
 			if (ABS(node->sign + (*son)->sign) == 1)
-				rotate(son, control);
-			rotate(get_fathers_ptr(node, root), !control);
+				rotate(son, control, root);
+			rotate(get_fathers_ptr(node, root), !control, root);
 			if (!after_delete || prevsign == 0)
 				return;
 		}
@@ -160,9 +295,93 @@ static int get_number_of_sons(avl_node_t *node) {
 	return !!node->sons[left] + !!node->sons[right];
 }
 
+/* rank of a possibly empty subtree under the WAVL policy */
+static int rank(avl_node_t *node) {
+	return (node == NULL) ? -1 : node->rank;
+}
+
+/* WAVL counterpart of balance after an insert - node is the inserted leaf
+ * walks up promoting fathers with a son of the same rank and finishes with
+ * at most two rotations */
+static void wavl_insert_balance(avl_node_t *node, avl_root_t *root) {
+	avl_node_t *father;
+	while ((father = node->father) != NULL && father->rank == node->rank) {
+		bool from_right = (father->sons[right] == node);
+		if (father->rank - rank(father->sons[!from_right]) == 1) {
+			++father->rank;
+			node = father;
+			continue;
+		}
+
+		avl_node_t *inner = node->sons[!from_right];
+		if (node->rank - rank(inner) == 2) {
+			rotate_links(get_fathers_ptr(father, root), !from_right, root);
+		} else {
+			rotate_links(&father->sons[from_right], from_right, root);
+			rotate_links(get_fathers_ptr(father, root), !from_right, root);
+			++inner->rank;
+			--node->rank;
+		}
+		--father->rank;
+		return;
+	}
+}
+
+/* WAVL counterpart of balance after a delete - father is the father of the
+ * removed node, whose place is now taken by the son on the from_right side
+ * walks up demoting nodes whose son is three ranks lower and finishes with at
+ * most two rotations */
+static void wavl_delete_balance(avl_node_t *father, bool from_right, avl_root_t *root) {
+	if (father == NULL)
+		return;
+
+	avl_node_t *node = father->sons[from_right];
+
+	/* a leaf has to be of rank 0 */
+	if (get_number_of_sons(father) == 0 && father->rank == 1) {
+		father->rank = 0;
+		node = father;
+		if ((father = node->father) == NULL)
+			return;
+		from_right = (father->sons[right] == node);
+	}
+
+	while (father->rank - rank(node) == 3) {
+		avl_node_t *sibling = father->sons[!from_right];
+		if (father->rank - sibling->rank == 2) {
+			--father->rank;
+		} else if (sibling->rank - rank(sibling->sons[left]) == 2
+			   && sibling->rank - rank(sibling->sons[right]) == 2) {
+			--father->rank;
+			--sibling->rank;
+		} else {
+			avl_node_t *inner = sibling->sons[from_right];
+			avl_node_t *outer = sibling->sons[!from_right];
+			if (sibling->rank - rank(outer) == 1) {
+				rotate_links(get_fathers_ptr(father, root), from_right, root);
+				++sibling->rank;
+				father->rank -= (get_number_of_sons(father) == 0) ? 2 : 1;
+			} else {
+				rotate_links(&father->sons[!from_right], !from_right, root);
+				rotate_links(get_fathers_ptr(father, root), from_right, root);
+				inner->rank += 2;
+				--sibling->rank;
+				father->rank -= 2;
+			}
+			return;
+		}
+
+		node = father;
+		if ((father = node->father) == NULL)
+			return;
+		from_right = (father->sons[right] == node);
+	}
+}
+
 /* replace a node by a newly inserted one */
 static void replace_by_new(avl_node_t **replaced, avl_node_t *replacement) {
 	replacement->sign = (*replaced)->sign;
+	replacement->deleted = false;
 
 	if ((*replaced)->sons[left] != NULL)
 		(*replaced)->sons[left]->father = replacement;
@@ -208,45 +427,198 @@ static avl_node_t *prevnext(avl_node_t *node, bool next) {
 	return node->father;
 }
 
-/* --- PUBLIC FUNCTIONS --------------------------------------- */
+/* first node from node on in the given direction which isn't a tombstone, the
+ * walk stops early at stop */
+static avl_node_t *skip_deleted(avl_node_t *node, bool next, avl_node_t *stop) {
+	while (node != NULL && node != stop && node->deleted)
+		node = prevnext(node, next);
+	return node;
+}
 
-/* returns pointer to node with given key or NULL if it wasn't found */
-avl_node_t *avl_find_impl(avl_node_t *key_node, avl_root_t *root) {
-	avl_node_t **out;
-	return avl_find_getaddr(key_node, root, &out) ? *out : NULL;
+/* climbs up from finger until an ancestor beyond key_node is found and returns
+ * pointer to father's pointer to the node the search for key_node should
+ * descend from - the last node passed on the way which lies between finger and
+ * key_node, as key_node belongs to its subtree on the side facing key_node
+ * ancestors are only compared to key_node when the climb comes from their side
+ * facing it, as the others lie behind finger */
+static avl_node_t **climb_from_finger(avl_node_t *finger, avl_node_t *key_node, avl_root_t *root) {
+	int comparison = compare_nodes(root, key_node, finger);
+	if (comparison == 0)
+		return get_fathers_ptr(finger, root);
+
+	bool towards_right = comparison > 0;
+	avl_node_t *node = finger, *bound = finger;
+	while (node->father != NULL) {
+		avl_node_t *father = node->father;
+		if (father->sons[!towards_right] == node) {
+			comparison = compare_nodes(root, key_node, father);
+			if (comparison == 0)
+				return get_fathers_ptr(father, root);
+			if (towards_right ? comparison < 0 : comparison > 0)
+				break;
+			bound = father;
+		}
+		node = father;
+	}
+	return get_fathers_ptr(bound, root);
 }
 
 /* if a node with given key already existed in the tree it is replaced by
  * new_node and the pointer to it is returned, otherwise the node is inserted
- * and NULL is returned */
-avl_node_t *avl_insert_impl(avl_node_t *new_node, avl_root_t *root) {
+ * and NULL is returned - the search descends from the node start points to */
+static avl_node_t *insert_from(avl_node_t **start, avl_node_t *new_node, avl_root_t *root) {
 	avl_node_t **ptr2father, *father;
-	bool found = avl_find_getaddr(new_node, root, &ptr2father);
+	bool found = find_getaddr_from(start, new_node, root, &ptr2father);
 	father = *ptr2father;
 
 	if (found) {
 		replace_by_new(ptr2father, new_node);
+		if (root->max_node == father)
+			root->max_node = new_node;
+		if (root->purge_cursor == father)
+			root->purge_cursor = new_node;
+		if (father->deleted)
+			--root->tombstones;
+		update_max_path(new_node, root);
 		return father;
 	}
 
-	*new_node = (avl_node_t){0};
-	new_node->father = father;
-	*((root->root_node == NULL) ? &root->root_node
-				    : choose_son(new_node, father, root)) = new_node;
+	avl_link_impl(new_node, father, father != NULL && compare_nodes(root, new_node, father) >= 0, root);
+	return NULL;
+}
+
+/* leftmost node of the subtree whose left subtree has no interval reaching
+ * low or NULL if no interval in the subtree reaches low */
+static avl_node_t *overlap_descend(avl_node_t *node, long low) {
+	if (subtree_max(node) < low)
+		return NULL;
+	while (subtree_max(node->sons[left]) >= low)
+		node = node->sons[left];
+	return node;
+}
 
-	if (father != NULL)
-		balance(father, root, compare_nodes(root, new_node, father) < 0, false);
+/* next node in order after node skipping the subtrees with no interval reaching low */
+static avl_node_t *overlap_successor(avl_node_t *node, long low) {
+	avl_node_t *next = overlap_descend(node->sons[right], low);
+	if (next != NULL)
+		return next;
+	while (node->father != NULL && node == node->father->sons[right])
+		node = node->father;
+	return node->father;
+}
 
+/* first node overlapping [low, high] in order starting from node
+ * the scan stops at the first node starting after high as all following do too */
+static avl_node_t *overlap_scan(avl_node_t *node, long low, long high) {
+	while (node != NULL && interval(node)->low <= high) {
+		if (interval(node)->high >= low && !node->deleted)
+			return node;
+		node = overlap_successor(node, low);
+	}
 	return NULL;
 }
 
-/* returns pointer to deleted node or NULL if it wasn't found */
+/* writes to a tree during a pass of avl_rebuild_step_impl - see REBUILDING */
+static avl_node_t *rebuild_insert(avl_node_t *new_node, avl_root_t *root);
+static void rebuild_link(avl_node_t *new_node, avl_root_t *root);
+static void rebuild_unlink(avl_node_t *node, avl_root_t *root);
+
+/* --- PUBLIC FUNCTIONS --------------------------------------- */
+
+/* returns pointer to node with given key or NULL if it wasn't found */
+avl_node_t *avl_find_impl(avl_node_t *key_node, avl_root_t *root) {
+	avl_node_t **out;
+	return (avl_find_getaddr(key_node, root, &out) && !(*out)->deleted) ? *out : NULL;
+}
+
+/* if a node with given key already existed in the tree it is replaced by
+ * new_node and the pointer to it is returned, otherwise the node is inserted
+ * and NULL is returned */
+avl_node_t *avl_insert_impl(avl_node_t *new_node, avl_root_t *root) {
+	if (root->rebuild != NULL)
+		return rebuild_insert(new_node, root);
+
+	/* append fast path - a key above the maximum goes right below it */
+	if (root->max_node != NULL && compare_nodes(root, new_node, root->max_node) > 0) {
+		avl_link_impl(new_node, root->max_node, right, root);
+		return NULL;
+	}
+	return insert_from(&root->root_node, new_node, root);
+}
+
+/* same as avl_insert_impl but the search starts from hint */
+avl_node_t *avl_insert_hint_impl(avl_node_t *new_node, avl_node_t *hint, avl_root_t *root) {
+	if (hint == NULL || root->rebuild != NULL)
+		return avl_insert_impl(new_node, root);
+	return insert_from(climb_from_finger(hint, new_node, root), new_node, root);
+}
+
+/* same as avl_find_impl but the search starts from finger */
+avl_node_t *avl_find_near_impl(avl_node_t *key_node, avl_node_t *finger, avl_root_t *root) {
+	if (finger == NULL)
+		return avl_find_impl(key_node, root);
+	avl_node_t **out;
+	bool found = find_getaddr_from(climb_from_finger(finger, key_node, root), key_node, root, &out);
+	return (found && !(*out)->deleted) ? *out : NULL;
+}
+
+/* returns pointer to deleted node or NULL if it wasn't found - a tombstone is
+ * removed and returned like any other node */
 avl_node_t *avl_delete_impl(avl_node_t *key_node, avl_root_t *root) {
-	avl_node_t **son, *node, *balance_start;
+	avl_node_t **son;
 	if (!avl_find_getaddr(key_node, root, &son))
 		return NULL;
 
-	node = *son;
+	avl_node_t *node = *son;
+	avl_unlink_impl(node, root);
+	return node;
+}
+
+/* links new_node into the tree as the left or right son of father, or as the
+ * root node if father is NULL - during a pass of avl_rebuild_step_impl the
+ * place is looked up again in the part new_node belongs to */
+void avl_link_impl(avl_node_t *new_node, avl_node_t *father, bool right, avl_root_t *root) {
+	if (root->rebuild != NULL) {
+		rebuild_link(new_node, root);
+		return;
+	}
+
+	*new_node = (avl_node_t){0};
+	new_node->father = father;
+	*((father == NULL) ? &root->root_node : &father->sons[right]) = new_node;
+	if (father == NULL || (right && father == root->max_node))
+		root->max_node = new_node;
+	++root->count;
+
+	/* max endpoints are brought up to date before any rotation */
+	if (root->interval) {
+		long high = interval(new_node)->max = interval(new_node)->high;
+		for (avl_node_t *node = father; node != NULL && interval(node)->max < high; node = node->father)
+			interval(node)->max = high;
+	}
+
+	if (root->policy == AVL_POLICY_WAVL)
+		wavl_insert_balance(new_node, root);
+	else if (father != NULL)
+		balance(father, root, !right, false);
+}
+
+/* removes node, which has to be present in the tree, from the tree */
+void avl_unlink_impl(avl_node_t *node, avl_root_t *root) {
+	if (root->rebuild != NULL) {
+		rebuild_unlink(node, root);
+		return;
+	}
+
+	if (node == root->max_node)
+		root->max_node = prevnext(node, AVL_PREV);
+	if (node == root->purge_cursor)
+		root->purge_cursor = prevnext(node, AVL_NEXT);
+	if (node->deleted)
+		--root->tombstones;
+	--root->count;
+
+	avl_node_t **son = get_fathers_ptr(node, root), *balance_start;
 	bool from_left;
 	if (get_number_of_sons(node) < 2) {
 		balance_start = node->father;
@@ -256,18 +628,47 @@ avl_node_t *avl_delete_impl(avl_node_t *key_node, avl_root_t *root) {
 			(*son)->father = node->father;
 	} else {
 		avl_node_t **min = minmax_of_tree(&node->sons[right], AVL_MIN);
-		balance_start = (compare_nodes(root, (*min)->father, key_node) != 0) ? (*min)->father : *min;
+		balance_start = ((*min)->father != node) ? (*min)->father : *min;
 		from_left = (balance_start->sons[left] == *min);
 		replace_node(son, min);
 	}
-	balance(balance_start, root, from_left, true);
+	update_max_path(balance_start, root);
 
-	return node;
+	if (root->policy == AVL_POLICY_WAVL)
+		wavl_delete_balance(balance_start, !from_left, root);
+	else
+		balance(balance_start, root, from_left, true);
+}
+
+/* fixes the links of the tree after the item containing old_node has been
+ * copied to the item containing new_node */
+void avl_relocate_impl(avl_node_t *old_node, avl_node_t *new_node, avl_root_t *root) {
+	/* ending a pass may change the links of old_node */
+	if (root->rebuild != NULL) {
+		avl_rebuild_stop_impl(root);
+		if (root->interval)
+			*interval(new_node) = *interval(old_node);
+		else
+			*new_node = *old_node;
+	}
+
+	if (root->max_node == old_node)
+		root->max_node = new_node;
+	if (root->purge_cursor == old_node)
+		root->purge_cursor = new_node;
+	*get_fathers_ptr(old_node, root) = new_node;
+	if (new_node->sons[left] != NULL)
+		new_node->sons[left]->father = new_node;
+	if (new_node->sons[right] != NULL)
+		new_node->sons[right]->father = new_node;
 }
 
 /* get minimal or maximal node according to the ordering specified by the comparator function */
 avl_node_t *avl_minmax_impl(avl_root_t *root, bool max) {
-	return *minmax_of_tree(&root->root_node, max);
+	if (root->root_node == NULL)
+		return NULL;
+	avl_node_t *node = max ? root->max_node : *minmax_of_tree(&root->root_node, max);
+	return (root->tombstones == 0) ? node : skip_deleted(node, !max, NULL);
 }
 
 /* returns closest lower/higher node according to the ordering defined by the comparator function
@@ -276,7 +677,7 @@ avl_node_t *avl_prevnext_impl(avl_root_t *root, avl_node_t *key_node, bool next)
 	avl_node_t *out = get_closest_node(root, key_node, next);
 	if (out != NULL && compare_nodes(root, key_node, out) == 0)
 		out = prevnext(out, next);
-	return out;
+	return (root->tombstones == 0) ? out : skip_deleted(out, next, NULL);
 }
 
 /* get new iterator */
@@ -289,6 +690,10 @@ avl_iterator_t avl_get_iterator_impl(avl_root_t *root, avl_node_t *lower_bound,
 
 	avl_node_t *lower = (lower_bound == NULL) ? min : get_closest_node(root, lower_bound, true);
 	avl_node_t *upper = (upper_bound == NULL) ? max : get_closest_node(root, upper_bound, false);
+	if (root->tombstones > 0) {
+		lower = skip_deleted(lower, AVL_NEXT, NULL);
+		upper = skip_deleted(upper, AVL_PREV, NULL);
+	}
 
 	/* if an invalid range is specified invalidate the iterator */
 	if (lower == NULL || upper == NULL
@@ -319,6 +724,8 @@ avl_node_t *avl_advance_impl(avl_iterator_t *iterator) {
 
 	avl_node_t *out = iterator->cur;
 	iterator->cur = prevnext(iterator->cur, iterator->low_to_high);
+	if (iterator->root->tombstones > 0)
+		iterator->cur = skip_deleted(iterator->cur, iterator->low_to_high, iterator->end);
 	return out;
 }
 
@@ -326,3 +733,1210 @@ avl_node_t *avl_advance_impl(avl_iterator_t *iterator) {
 avl_node_t *avl_peek_impl(avl_iterator_t *iterator) {
 	return iterator->cur;
 }
+
+/* get the first item in order which overlaps [low, high] in an interval tree */
+avl_node_t *avl_overlap_first_impl(avl_root_t *root, long low, long high) {
+	if (low > high)
+		return NULL;
+	return overlap_scan(overlap_descend(root->root_node, low), low, high);
+}
+
+/* get new iterator over the items of an interval tree overlapping [low, high] */
+avl_overlap_iterator_t avl_overlap_iterate_impl(avl_root_t *root, long low, long high) {
+	return (avl_overlap_iterator_t){
+		.cur = avl_overlap_first_impl(root, low, high),
+		.low = low,
+		.high = high
+	};
+}
+
+/* get next item from overlap iterator */
+avl_node_t *avl_overlap_advance_impl(avl_overlap_iterator_t *iterator) {
+	avl_node_t *out = iterator->cur;
+	if (out != NULL)
+		iterator->cur = overlap_scan(overlap_successor(out, iterator->low), iterator->low, iterator->high);
+	return out;
+}
+
+/* --- SERIALIZATION ------------------------------------------ */
+
+static void put_u32(unsigned char *buf, uint32_t value) {
+	for (int i = 0; i < 4; ++i)
+		buf[i] = value >> (8 * i);
+}
+
+static uint32_t get_u32(const unsigned char *buf) {
+	return buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+/* grows buffer to at least size bytes and returns false if out of memory */
+static bool reserve(unsigned char **buf, size_t *capacity, size_t size) {
+	if (size <= *capacity)
+		return true;
+	size_t new_capacity = MAX(*capacity * 2, size);
+	unsigned char *new_buf = realloc(*buf, new_capacity);
+	if (new_buf == NULL)
+		return false;
+	*buf = new_buf;
+	*capacity = new_capacity;
+	return true;
+}
+
+/* sets the balance information and the max endpoint of node from the heights of its subtrees */
+static void set_balance(avl_node_t *node, int lheight, int rheight, avl_root_t *root) {
+	if (root->policy == AVL_POLICY_WAVL)
+		node->rank = MAX(lheight, rheight); // an AVL tree is a WAVL tree with ranks one below heights
+	else
+		node->sign = rheight - lheight;
+	if (root->interval)
+		interval(node)->max = compute_max(node);
+}
+
+static void set_son(avl_node_t *father, avl_node_t *son, bool right) {
+	father->sons[right] = son;
+	if (son != NULL)
+		son->father = father;
+}
+
+/* merges the perfect trees of slots as in a binary counter */
+static void build_merge(build_ctx_t *ctx) {
+	while (ctx->depth > 0 && ctx->stack[ctx->depth - 1].slots == ctx->carry_slots) {
+		avl_node_t *top = ctx->stack[--ctx->depth].node;
+		int height = ctx->stack[ctx->depth].height;
+		set_son(top, ctx->carry, right);
+		set_balance(top, height, ctx->carry_height, ctx->root);
+		ctx->carry = top;
+		ctx->carry_height = MAX(height, ctx->carry_height) + 1;
+		++ctx->carry_slots;
+	}
+}
+
+/* adds node, which has to be greater than all the nodes added before, to the
+ * tree being built */
+static void build_push(build_ctx_t *ctx, avl_node_t *node) {
+	set_son(node, ctx->carry, left);
+	ctx->stack[ctx->depth].node = node;
+	ctx->stack[ctx->depth].height = ctx->carry_height;
+	ctx->stack[ctx->depth++].slots = ctx->carry_slots;
+	ctx->carry = NULL;
+	ctx->carry_height = ctx->carry_slots = 0;
+	ctx->last = node;
+	++ctx->count;
+	build_merge(ctx);
+}
+
+/* leaves the next slot, which has to be a leaf, empty - the heights of the
+ * trees above it stay within one of the heights of their slots, so the result
+ * stays balanced as long as only the leaves of a single perfect tree of slots
+ * are skipped */
+static void build_skip(build_ctx_t *ctx) {
+	ctx->carry_slots = 1;
+	build_merge(ctx);
+}
+
+/* joins the trees left on the stack of a build without empty slots and returns
+ * the root of the result, whose height is left in carry_height - the left
+ * subtree of a node on the stack is always higher than carry, if by
+ * more than one the node takes the place of the subtree of the height of
+ * carry on its right spine, which makes the spine nodes above right heavy */
+static avl_node_t *build_finish(build_ctx_t *ctx) {
+	while (ctx->depth > 0) {
+		avl_node_t *node = ctx->stack[--ctx->depth].node;
+		int height = ctx->stack[ctx->depth].height;
+		if (height - ctx->carry_height <= 1) {
+			set_son(node, ctx->carry, right);
+			set_balance(node, height, ctx->carry_height, ctx->root);
+			ctx->carry = node;
+			ctx->carry_height = height + 1;
+			continue;
+		}
+
+		avl_node_t *top = node->sons[left], *spine = top;
+		for (int spine_height = height; spine_height > ctx->carry_height + 1; --spine_height)
+			spine = spine->sons[right];
+		set_son(node, spine->sons[right], left);
+		set_son(node, ctx->carry, right);
+		set_balance(node, ctx->carry_height, ctx->carry_height, ctx->root);
+		set_son(spine, node, right);
+		for (int spine_height = ctx->carry_height + 1;; spine = spine->father, ++spine_height) {
+			set_balance(spine, spine_height - 1, spine_height, ctx->root);
+			if (spine == top)
+				break;
+		}
+		ctx->carry = top;
+		ctx->carry_height = height + 1;
+	}
+
+	if (ctx->carry != NULL)
+		ctx->carry->father = NULL;
+	return ctx->carry;
+}
+
+/* makes the tree built from nodes which aren't tombstones the tree of the root */
+static void build_root(build_ctx_t *ctx) {
+	avl_root_t *root = ctx->root;
+	root->root_node = build_finish(ctx);
+	root->max_node = ctx->last;
+	root->count = ctx->count;
+	root->tombstones = 0;
+	root->purge_cursor = NULL;
+}
+
+/* writes the items in order as chunks of length prefixed encodings and
+ * returns 0 on success
+ * every chunk starts with the number of its items and a chunk of no items
+ * ends the stream, all numbers are 32 bit little endian */
+int avl_serialize_impl(avl_root_t *root, avl_encode_fn encode, avl_write_fn write, void *ctx) {
+	size_t capacity = SERIALIZE_BUFFER_SIZE, used = 4;
+	unsigned char *buf = malloc(capacity);
+	if (buf == NULL)
+		return -1;
+
+	int status = 0;
+	uint32_t count = 0;
+	avl_node_t *node = (root->root_node == NULL) ? NULL : *minmax_of_tree(&root->root_node, AVL_MIN);
+	for (; node != NULL && status == 0; node = prevnext(node, AVL_NEXT)) {
+		if (node->deleted)
+			continue;
+		void *item = AVL_UPCAST(node, root->offset);
+		size_t size = 0;
+		do {
+			if (size > UINT32_MAX || !reserve(&buf, &capacity, used + 4 + size)) {
+				status = -1;
+				break;
+			}
+			size = encode(ctx, item, buf + used + 4, capacity - used - 4);
+		} while (size > capacity - used - 4);
+		if (status != 0)
+			break;
+
+		put_u32(buf + used, size);
+		used += 4 + size;
+		if (++count == SERIALIZE_CHUNK_ITEMS) {
+			put_u32(buf, count);
+			status = write(ctx, buf, used);
+			used = 4;
+			count = 0;
+		}
+	}
+
+	if (status == 0 && count > 0) {
+		put_u32(buf, count);
+		status = write(ctx, buf, used);
+	}
+	if (status == 0) {
+		put_u32(buf, 0);
+		status = write(ctx, buf, 4);
+	}
+	free(buf);
+	return (status == 0) ? 0 : -1;
+}
+
+/* links the items of a stream written by avl_serialize_impl into an empty tree
+ * at most one level higher than the lowest possible one and returns 0 on success
+ * the items are linked as they arrive, so only O(log n) memory is needed
+ * besides the buffer of a single item, on failure the items decoded so far are
+ * left in the tree except for an item out of order, which isn't linked */
+int avl_deserialize_impl(avl_root_t *root, avl_read_fn read, avl_decode_fn decode, avl_release_fn release,
+			 void *ctx) {
+	if (root->root_node != NULL)
+		return -1;
+
+	size_t capacity = SERIALIZE_BUFFER_SIZE;
+	unsigned char *buf = malloc(capacity);
+	if (buf == NULL)
+		return -1;
+
+	build_ctx_t build = { .root = root };
+	uint32_t count;
+	int status = 0;
+	while (status == 0 && (status = read(ctx, buf, 4)) == 0 && (count = get_u32(buf)) != 0) {
+		for (; count > 0; --count) {
+			if ((status = read(ctx, buf, 4)) != 0)
+				break;
+			size_t size = get_u32(buf);
+			if (!reserve(&buf, &capacity, size) || (status = read(ctx, buf, size)) != 0) {
+				status = -1;
+				break;
+			}
+
+			void *item = decode(ctx, buf, size);
+			avl_node_t *node = AVL_DOWNCAST(item, root->offset);
+			if (node == NULL || (build.last != NULL && compare_nodes(root, build.last, node) >= 0)) {
+				if (node != NULL && release != NULL)
+					release(ctx, item);
+				status = -1;
+				break;
+			}
+			node->deleted = false;
+			build_push(&build, node);
+		}
+	}
+
+	build_root(&build);
+	free(buf);
+	return (status == 0) ? 0 : -1;
+}
+
+/* --- LAZY DELETION ------------------------------------------ */
+
+/* marks the node with given key as deleted and returns it or NULL if there is
+ * no such node which isn't marked yet */
+avl_node_t *avl_mark_deleted_impl(avl_node_t *key_node, avl_root_t *root) {
+	avl_node_t *node = avl_find_impl(key_node, root);
+	if (node != NULL) {
+		node->deleted = true;
+		++root->tombstones;
+	}
+	return node;
+}
+
+/* links the nodes which aren't tombstones into a new tree of the same shape as
+ * one built by avl_deserialize_impl and releases the tombstones
+ * the in-order walk reads the right son of a node before the node is handed
+ * over, the nodes on the stack are only modified once they have been visited */
+static void purge_rebuild(avl_root_t *root, avl_release_fn release, void *ctx) {
+	build_ctx_t build = { .root = root };
+	avl_node_t *stack[AVL_MAX_HEIGHT], *node = root->root_node;
+	int depth = 0;
+	while (node != NULL || depth > 0) {
+		for (; node != NULL; node = node->sons[left])
+			stack[depth++] = node;
+		node = stack[--depth];
+
+		avl_node_t *next = node->sons[right];
+		if (!node->deleted)
+			build_push(&build, node);
+		else if (release != NULL)
+			release(ctx, AVL_UPCAST(node, root->offset));
+		node = next;
+	}
+	build_root(&build);
+}
+
+/* removes the nodes marked deleted and passes their items to release
+ * with a budget the nodes are visited in order from the purge cursor, which
+ * wraps around after the maximal node, and every tombstone is unlinked on its
+ * own, so that the other operations may run between the calls */
+size_t avl_purge_impl(avl_root_t *root, avl_release_fn release, void *ctx, size_t budget) {
+	if (root->tombstones == 0)
+		return 0;
+	if (budget == 0) {
+		if (root->rebuild != NULL)
+			avl_rebuild_stop_impl(root);
+		purge_rebuild(root, release, ctx);
+		return 0;
+	}
+
+	avl_node_t *node = root->purge_cursor;
+	if (node == NULL)
+		node = *minmax_of_tree(&root->root_node, AVL_MIN);
+	for (; budget > 0 && node != NULL && root->tombstones > 0; --budget) {
+		avl_node_t *next = prevnext(node, AVL_NEXT);
+		if (node->deleted) {
+			avl_unlink_impl(node, root);
+			if (release != NULL)
+				release(ctx, AVL_UPCAST(node, root->offset));
+		}
+		node = next;
+	}
+	root->purge_cursor = node;
+	return root->tombstones;
+}
+
+/* returns the share of tombstones among the nodes of the tree */
+double avl_tombstone_ratio_impl(avl_root_t *root) {
+	return (root->count == 0) ? 0.0 : (double)root->tombstones / root->count;
+}
+
+/* --- REBUILDING --------------------------------------------- */
+
+/* maximal node of a possibly empty subtree */
+static avl_node_t *rightmost(avl_node_t *node) {
+	return (node == NULL) ? NULL : *minmax_of_tree(&node, AVL_MAX);
+}
+
+/* rank of a possibly empty subtree, which is its height minus one under
+ * AVL_POLICY_AVL */
+static int tree_rank(avl_node_t *node, avl_root_t *root) {
+	if (root->policy == AVL_POLICY_WAVL)
+		return rank(node);
+	int height = 0;
+	for (; node != NULL; node = node->sons[node->sign > 0])
+		++height;
+	return height - 1;
+}
+
+/* rank of the son on the given side of node, which is of rank node_rank */
+static int son_rank(avl_node_t *node, int node_rank, bool side, avl_root_t *root) {
+	if (root->policy == AVL_POLICY_WAVL)
+		return rank(node->sons[side]);
+	return node_rank - 1 - ((side == right) ? node->sign < 0 : node->sign > 0);
+}
+
+/* joins the valid trees lower and upper, whose nodes are all lower and higher
+ * than node respectively, into a valid tree and returns its root
+ * node goes down the inner spine of the higher tree to the first subtree of at
+ * most one rank more than the other tree and takes it as its son, which the
+ * spine above sees as a subtree grown by one rank just like after an insert */
+static avl_node_t *join(avl_node_t *lower, avl_node_t *node, avl_node_t *upper, avl_root_t *root) {
+	int lrank = tree_rank(lower, root), urank = tree_rank(upper, root);
+	bool upper_higher = urank > lrank;
+	avl_root_t sub = *root;
+	sub.root_node = upper_higher ? upper : lower;
+
+	avl_node_t *father = NULL, **spine = upper_higher ? &upper : &lower;
+	int *spine_rank = upper_higher ? &urank : &lrank, other_rank = upper_higher ? lrank : urank;
+	while (*spine_rank > other_rank + 1) {
+		father = *spine;
+		*spine_rank = son_rank(father, *spine_rank, !upper_higher, root);
+		*spine = father->sons[!upper_higher];
+	}
+
+	set_son(node, lower, left);
+	set_son(node, upper, right);
+	set_balance(node, lrank + 1, urank + 1, root);
+	node->father = NULL;
+	if (father == NULL)
+		return node;
+
+	set_son(father, node, !upper_higher);
+	update_max_path(father, &sub);
+	if (root->policy == AVL_POLICY_WAVL)
+		wavl_insert_balance(node, &sub);
+	else
+		balance(father, &sub, upper_higher, false);
+	return sub.root_node;
+}
+
+/* joins two valid trees, the nodes of lower all being lower than those of
+ * upper, by the minimal node of upper and returns the root of the result */
+static avl_node_t *join_trees(avl_node_t *lower, avl_node_t *upper, avl_root_t *root) {
+	if (lower == NULL || upper == NULL)
+		return (lower == NULL) ? upper : lower;
+
+	avl_root_t sub = *root;
+	sub.rebuild = NULL;
+	sub.root_node = upper;
+	avl_node_t *node = *minmax_of_tree(&sub.root_node, AVL_MIN);
+	avl_unlink_impl(node, &sub);
+	return join(lower, node, sub.root_node, root);
+}
+
+/* threads the parts of a pass, which has nodes left to visit, into a single
+ * search tree, in which every part hangs as the right son of the maximal node
+ * of the parts before it, and brings the max endpoints on the way and the
+ * maximal node up to date */
+static void rebuild_thread(avl_root_t *root) {
+	struct avl_rebuild *rb = root->rebuild;
+	avl_node_t *chain = rb->upper, *lowest = NULL;
+
+	rb->carry_tail = rightmost(rb->build.carry);
+	if (rb->carry_tail != NULL) {
+		set_son(rb->carry_tail, chain, right);
+		lowest = rb->carry_tail;
+		chain = rb->build.carry;
+	}
+	for (int i = rb->build.depth; i-- > 0; chain = rb->build.stack[i].node) {
+		set_son(rb->build.stack[i].node, chain, right);
+		if (lowest == NULL)
+			lowest = rb->build.stack[i].node;
+	}
+	rb->lower_tail = rightmost(rb->lower);
+	if (rb->lower_tail != NULL) {
+		set_son(rb->lower_tail, chain, right);
+		if (lowest == NULL)
+			lowest = rb->lower_tail;
+		chain = rb->lower;
+	}
+
+	root->root_node = chain;
+	if (chain != NULL)
+		chain->father = NULL;
+	update_max_path(lowest, root);
+	root->max_node = rightmost(rb->upper);
+}
+
+/* undoes rebuild_thread */
+static void rebuild_unthread(avl_root_t *root) {
+	struct avl_rebuild *rb = root->rebuild;
+	rb->build.root = root;
+	if (rb->upper != NULL)
+		rb->upper->father = NULL;
+	if (rb->build.carry != NULL)
+		rb->build.carry->father = NULL;
+	if (rb->carry_tail != NULL) {
+		rb->carry_tail->sons[right] = NULL;
+		update_max_path(rb->carry_tail, root);
+	}
+	if (rb->lower_tail != NULL) {
+		rb->lower_tail->sons[right] = NULL;
+		update_max_path(rb->lower_tail, root);
+	}
+}
+
+/* plans the part to be built as the lowest perfect tree of slots with room for
+ * all the nodes left to visit, the slots left over are leaves */
+static void rebuild_plan(struct avl_rebuild *rb) {
+	size_t size = 0;
+	while (size < rb->left)
+		size = 2 * size + 1;
+	rb->closed_slots += rb->slots;
+	rb->slots = 0;
+	rb->leaves = (size + 1) / 2;
+	rb->holes = size - rb->left;
+	rb->spread = 0;
+}
+
+/* skips the leaf slots ahead which are to be left empty, a slot follows an
+ * even number of slots if it is a leaf and the holes are spread evenly among
+ * the leaves - the slot the loop stops at is taken by the next node pushed */
+static void rebuild_skip_holes(struct avl_rebuild *rb) {
+	while (rb->slots % 2 == 0 && rb->slots + 1 < 2 * rb->leaves) {
+		rb->spread += rb->holes;
+		if (rb->spread < rb->leaves)
+			return;
+		rb->spread -= rb->leaves;
+		build_skip(&rb->build);
+		++rb->slots;
+	}
+}
+
+/* joins the trees left on the stack of the part being built, which are only
+ * perfect trees of slots if the plan held, and returns the root of the result */
+static avl_node_t *rebuild_finish(avl_root_t *root) {
+	build_ctx_t *ctx = &root->rebuild->build;
+	avl_node_t *tree = ctx->carry;
+	if (tree != NULL)
+		tree->father = NULL;
+	while (ctx->depth > 0) {
+		avl_node_t *node = ctx->stack[--ctx->depth].node, *lower = node->sons[left];
+		if (lower != NULL)
+			lower->father = NULL;
+		tree = join(lower, node, tree, root);
+	}
+	return tree;
+}
+
+/* closes the part being built by joining it to lower and plans the next one */
+static void rebuild_close(avl_root_t *root) {
+	struct avl_rebuild *rb = root->rebuild;
+	avl_node_t *built = rebuild_finish(root);
+	rb->build = (build_ctx_t){ .root = root };
+	rb->lower = join_trees(rb->lower, built, root);
+	rebuild_plan(rb);
+}
+
+/* ends an unthreaded pass by joining its parts into the tree of the root */
+static void rebuild_end(avl_root_t *root) {
+	struct avl_rebuild *rb = root->rebuild;
+	rebuild_close(root);
+	root->root_node = join_trees(rb->lower, rb->upper, root);
+	root->max_node = rightmost(root->root_node);
+	root->rebuild = NULL;
+	free(rb);
+}
+
+/* unthreads the parts of a pass and sets sub up as the root of the part the
+ * key of node belongs to, a key within the part being built closes it first
+ * so that it belongs to lower - returns true for lower */
+static bool rebuild_enter(avl_root_t *root, avl_node_t *node, avl_root_t *sub) {
+	struct avl_rebuild *rb = root->rebuild;
+	rebuild_unthread(root);
+
+	bool lower;
+	if (rb->build.last == NULL) {
+		avl_node_t *lower_max = rightmost(rb->lower);
+		lower = lower_max != NULL && compare_nodes(root, node, lower_max) <= 0;
+	} else if (compare_nodes(root, node, rb->build.last) > 0) {
+		lower = false;
+	} else {
+		if (compare_nodes(root, node, rb->first) >= 0)
+			rebuild_close(root);
+		lower = true;
+	}
+
+	*sub = *root;
+	sub->rebuild = NULL;
+	sub->root_node = lower ? rb->lower : rb->upper;
+	sub->max_node = rightmost(sub->root_node);
+	return lower;
+}
+
+/* takes over the part sub was set up for by rebuild_enter and threads the
+ * parts again or ends the pass if there is nothing left to visit */
+static void rebuild_leave(avl_root_t *root, avl_root_t *sub, bool lower) {
+	struct avl_rebuild *rb = root->rebuild;
+	if (lower) {
+		rb->lower = sub->root_node;
+	} else {
+		rb->upper = sub->root_node;
+		if (sub->count > root->count)
+			rb->left += sub->count - root->count;
+		else
+			rb->left -= root->count - sub->count;
+		if (rb->slots == 0)
+			rebuild_plan(rb);
+	}
+	root->count = sub->count;
+	root->tombstones = sub->tombstones;
+	root->purge_cursor = sub->purge_cursor;
+
+	if (rb->upper == NULL)
+		rebuild_end(root);
+	else
+		rebuild_thread(root);
+}
+
+static avl_node_t *rebuild_insert(avl_node_t *new_node, avl_root_t *root) {
+	avl_root_t sub;
+	bool lower = rebuild_enter(root, new_node, &sub);
+	avl_node_t *replaced = avl_insert_impl(new_node, &sub);
+	rebuild_leave(root, &sub, lower);
+	return replaced;
+}
+
+static void rebuild_link(avl_node_t *new_node, avl_root_t *root) {
+	avl_root_t sub;
+	bool lower = rebuild_enter(root, new_node, &sub);
+	avl_node_t **ptr2father, *father;
+	find_getaddr_from(&sub.root_node, new_node, &sub, &ptr2father);
+	father = *ptr2father;
+	avl_link_impl(new_node, father, father != NULL && compare_nodes(root, new_node, father) >= 0, &sub);
+	rebuild_leave(root, &sub, lower);
+}
+
+static void rebuild_unlink(avl_node_t *node, avl_root_t *root) {
+	/* the next node may lie in another part */
+	if (node == root->purge_cursor)
+		root->purge_cursor = prevnext(node, AVL_NEXT);
+
+	avl_root_t sub;
+	bool lower = rebuild_enter(root, node, &sub);
+	avl_unlink_impl(node, &sub);
+	rebuild_leave(root, &sub, lower);
+}
+
+/* position of the node of given in-order index, counted from 1, of a perfect
+ * tree of given height in its van Emde Boas layout - the top half of the
+ * levels comes first followed by the bottom trees from left to right, each of
+ * them laid out the same way */
+static size_t veb_slot(size_t index, int height) {
+	size_t slot = 0;
+	while (height > 1) {
+		int bottom = height / 2, top = height - bottom;
+		size_t bottom_size = ((size_t)1 << bottom) - 1;
+		if ((index & bottom_size) != 0) {
+			slot += (((size_t)1 << top) - 1) + (index >> bottom) * bottom_size;
+			index &= bottom_size;
+			height = bottom;
+		} else {
+			index >>= bottom;
+			height = top;
+		}
+	}
+	return slot;
+}
+
+/* moves the item of node, which isn't linked, into its slot of the layout
+ * buffer if there is one and returns the node of the item in the tree
+ * the part being built fills a perfect tree of slots, so the van Emde Boas
+ * order is computed over the slots for the highest perfect tree which fits
+ * into the buffer - all of the first part if the buffer has room for it */
+static avl_node_t *rebuild_relocate(avl_root_t *root, avl_node_t *node) {
+	struct avl_rebuild *rb = root->rebuild;
+	size_t index = rb->closed_slots + rb->slots + 1, slot = SIZE_MAX;
+	if (rb->layout.order == AVL_LAYOUT_INORDER)
+		slot = rb->visited;
+	else if (index < (size_t)1 << rb->veb_height)
+		slot = veb_slot(index, rb->veb_height);
+	if (slot >= rb->layout.capacity)
+		return node;
+
+	void *item = AVL_UPCAST(node, root->offset);
+	void *copy = (unsigned char *)rb->layout.buffer + slot * rb->item_size;
+	memcpy(copy, item, rb->item_size);
+	avl_node_t *moved = AVL_DOWNCAST(copy, root->offset);
+	if (root->purge_cursor == node)
+		root->purge_cursor = moved;
+	if (rb->layout.release != NULL)
+		rb->layout.release(rb->layout.ctx, item);
+	return moved;
+}
+
+/* moves budget nodes, 0 meaning all of them, in order from upper into the
+ * part being built - a pass starts with the whole tree in upper and ends once
+ * upper is empty */
+size_t avl_rebuild_step_impl(avl_root_t *root, size_t budget, const avl_layout_t *layout, size_t item_size) {
+	struct avl_rebuild *rb = root->rebuild;
+	if (rb == NULL) {
+		if (root->root_node == NULL)
+			return 0;
+		if ((rb = malloc(sizeof(*rb))) == NULL)
+			return SIZE_MAX;
+		*rb = (struct avl_rebuild){
+			.build = { .root = root },
+			.upper = root->root_node,
+			.left = root->count,
+			.relocate = layout != NULL,
+			.item_size = item_size,
+		};
+		if (layout != NULL) {
+			rb->layout = *layout;
+			while (rb->veb_height < 63 && ((size_t)2 << rb->veb_height) - 1 <= layout->capacity)
+				++rb->veb_height;
+		}
+		rebuild_plan(rb);
+		root->rebuild = rb;
+	} else {
+		rebuild_unthread(root);
+	}
+
+	avl_root_t sub = *root;
+	sub.rebuild = NULL;
+	sub.root_node = rb->upper;
+	for (size_t visited = 0; sub.root_node != NULL && (budget == 0 || visited < budget); ++visited) {
+		avl_node_t *node = *minmax_of_tree(&sub.root_node, AVL_MIN);
+		avl_unlink_impl(node, &sub);
+		rebuild_skip_holes(rb);
+		if (rb->relocate)
+			node = rebuild_relocate(root, node);
+		if (rb->build.last == NULL)
+			rb->first = node;
+		build_push(&rb->build, node);
+		--rb->left;
+		++rb->visited;
+		++rb->slots;
+	}
+	rb->upper = sub.root_node;
+
+	if (rb->upper == NULL) {
+		rebuild_skip_holes(rb);
+		rebuild_end(root);
+		return 0;
+	}
+	rebuild_thread(root);
+	return rb->left;
+}
+
+/* the parts are joined in O(log n) */
+void avl_rebuild_stop_impl(avl_root_t *root) {
+	if (root->rebuild == NULL)
+		return;
+	rebuild_unthread(root);
+	rebuild_end(root);
+}
+
+/* --- LEAN TREES --------------------------------------------- */
+
+/* compare_nodes for lean trees */
+static int compare_lean(avl_lean_root_t *root, avl_lean_node_t *node1, avl_lean_node_t *node2) {
+	return root->cmp(AVL_LEAN_UPCAST(node1, root->offset), AVL_LEAN_UPCAST(node2, root->offset));
+}
+
+/* edge rotation as in rotate for lean trees - there are no fathers to update */
+static void lean_rotate(avl_lean_node_t **ynode, bool left_to_right) {
+	avl_lean_node_t *xnode = (*ynode)->sons[!left_to_right];
+	rotate_signs(&(*ynode)->sign, &xnode->sign, left_to_right);
+
+#ifdef AVL_STATS
+	++avl_stats_rotations;
+#endif
+
+	(*ynode)->sons[!left_to_right] = xnode->sons[left_to_right];
+	xnode->sons[left_to_right] = *ynode;
+	*ynode = xnode;
+}
+
+/* counterpart of balance for lean trees
+ * path holds the pointers to fathers' pointers to the nodes on the path from
+ * the root down to the father of the inserted/deleted node and dirs the sides
+ * taken from them */
+static void lean_balance(avl_lean_node_t **path[], bool dirs[], int depth, bool after_delete) {
+	while (depth-- > 0) {
+		avl_lean_node_t **link = path[depth], *node = *link;
+		/* the subtree on the side of dirs[depth] got lower after a delete
+		 * and higher after an insert */
+		bool control = after_delete ? !dirs[depth] : dirs[depth];
+		node->sign += (control ? +1 : -1);
+		if (ABS(node->sign) == after_delete)
+			return;
+
+		if (ABS(node->sign) == 2) {
+			avl_lean_node_t **son = &node->sons[control];
+			int prevsign = (*son)->sign;
+			if (ABS(node->sign + (*son)->sign) == 1)
+				lean_rotate(son, control);
+			lean_rotate(link, !control);
+			if (!after_delete || prevsign == 0)
+				return;
+		}
+	}
+}
+
+/* returns pointer to node with given key or NULL if it wasn't found */
+avl_lean_node_t *avl_lean_find_impl(avl_lean_node_t *key_node, avl_lean_root_t *root) {
+	avl_lean_node_t *node = root->root_node;
+	int comparison;
+	while (node != NULL && (comparison = compare_lean(root, key_node, node)) != 0)
+		node = node->sons[comparison > 0];
+	return node;
+}
+
+/* if a node with given key already existed in the tree it is replaced by
+ * new_node and the pointer to it is returned, otherwise the node is inserted
+ * and NULL is returned */
+avl_lean_node_t *avl_lean_insert_impl(avl_lean_node_t *new_node, avl_lean_root_t *root) {
+	avl_lean_node_t **path[AVL_MAX_HEIGHT], **link = &root->root_node;
+	bool dirs[AVL_MAX_HEIGHT];
+	int depth = 0;
+
+	while (*link != NULL) {
+		int comparison = compare_lean(root, new_node, *link);
+		if (comparison == 0) {
+			avl_lean_node_t *replaced = *link;
+			*new_node = *replaced;
+			*link = new_node;
+			return replaced;
+		}
+		path[depth] = link;
+		dirs[depth++] = comparison > 0;
+		link = &(*link)->sons[comparison > 0];
+	}
+
+	*new_node = (avl_lean_node_t){0};
+	*link = new_node;
+	lean_balance(path, dirs, depth, false);
+	return NULL;
+}
+
+/* returns pointer to deleted node or NULL if it wasn't found */
+avl_lean_node_t *avl_lean_delete_impl(avl_lean_node_t *key_node, avl_lean_root_t *root) {
+	avl_lean_node_t **path[AVL_MAX_HEIGHT], **link = &root->root_node;
+	bool dirs[AVL_MAX_HEIGHT];
+	int depth = 0, comparison;
+
+	while (*link != NULL && (comparison = compare_lean(root, key_node, *link)) != 0) {
+		path[depth] = link;
+		dirs[depth++] = comparison > 0;
+		link = &(*link)->sons[comparison > 0];
+	}
+	avl_lean_node_t *node = *link;
+	if (node == NULL)
+		return NULL;
+
+	if (node->sons[left] == NULL || node->sons[right] == NULL) {
+		*link = (node->sons[left] != NULL) ? node->sons[left] : node->sons[right];
+	} else {
+		/* replace node with the minimum of its right subtree */
+		int node_depth = depth;
+		path[depth] = link;
+		dirs[depth++] = right;
+		avl_lean_node_t **min = &node->sons[right];
+		while ((*min)->sons[left] != NULL) {
+			path[depth] = min;
+			dirs[depth++] = left;
+			min = &(*min)->sons[left];
+		}
+
+		avl_lean_node_t *replacement = *min;
+		*min = replacement->sons[right];
+		*replacement = *node;
+		*link = replacement;
+		/* the path below went through the right son pointer of node */
+		if (node_depth + 1 < depth)
+			path[node_depth + 1] = &replacement->sons[right];
+	}
+
+	lean_balance(path, dirs, depth, true);
+	return node;
+}
+
+/* get minimal or maximal node or NULL if the tree is empty */
+avl_lean_node_t *avl_lean_minmax_impl(avl_lean_root_t *root, bool max) {
+	avl_lean_node_t *node = root->root_node;
+	while (node != NULL && node->sons[max] != NULL)
+		node = node->sons[max];
+	return node;
+}
+
+/* returns closest lower/higher node, key_node itself doesn't have to be in the tree */
+avl_lean_node_t *avl_lean_prevnext_impl(avl_lean_root_t *root, avl_lean_node_t *key_node, bool next) {
+	avl_lean_node_t *out = NULL, *node = root->root_node;
+	while (node != NULL) {
+		int comparison = compare_lean(root, key_node, node);
+		if (next ? comparison < 0 : comparison > 0) {
+			out = node;
+			node = node->sons[!next];
+		} else {
+			node = node->sons[next];
+		}
+	}
+	return out;
+}
+
+/* pushes node and its descendants on the way towards the first node in the
+ * order of iterator which isn't before bound onto the stack */
+static void lean_push_path(avl_lean_root_t *root, avl_lean_iterator_t *iterator, avl_lean_node_t *node,
+			   avl_lean_node_t *bound) {
+	bool next = iterator->low_to_high;
+	while (node != NULL) {
+		int comparison = (bound == NULL) ? 0 : compare_lean(root, node, bound);
+		if (next ? comparison < 0 : comparison > 0) {
+			node = node->sons[next];
+		} else {
+			iterator->stack[iterator->depth++] = node;
+			node = (comparison == 0 && bound != NULL) ? NULL : node->sons[!next];
+		}
+	}
+}
+
+/* get new iterator */
+avl_lean_iterator_t avl_lean_get_iterator_impl(avl_lean_root_t *root, avl_lean_node_t *lower_bound,
+					       avl_lean_node_t *upper_bound, bool low_to_high) {
+	avl_lean_iterator_t iterator = { .depth = 0, .low_to_high = low_to_high };
+	avl_lean_node_t *start_bound = low_to_high ? lower_bound : upper_bound;
+	avl_lean_node_t *end_bound = low_to_high ? upper_bound : lower_bound;
+
+	lean_push_path(root, &iterator, root->root_node, start_bound);
+	if (end_bound == NULL) {
+		iterator.end = avl_lean_minmax_impl(root, low_to_high);
+	} else {
+		iterator.end = avl_lean_find_impl(end_bound, root);
+		if (iterator.end == NULL)
+			iterator.end = avl_lean_prevnext_impl(root, end_bound, !low_to_high);
+	}
+
+	/* if an invalid range is specified invalidate the iterator */
+	avl_lean_node_t *start = avl_lean_peek_impl(&iterator);
+	if (start == NULL || iterator.end == NULL
+	    || (low_to_high ? compare_lean(root, start, iterator.end) > 0 : compare_lean(root, start, iterator.end) < 0))
+		iterator.depth = 0;
+	return iterator;
+}
+
+/* get next node from iterator */
+avl_lean_node_t *avl_lean_advance_impl(avl_lean_iterator_t *iterator) {
+	if (iterator->depth == 0)
+		return NULL;
+
+	avl_lean_node_t *out = iterator->stack[--iterator->depth];
+	if (out == iterator->end) {
+		iterator->depth = 0;
+		return out;
+	}
+
+	bool next = iterator->low_to_high;
+	for (avl_lean_node_t *node = out->sons[next]; node != NULL; node = node->sons[!next])
+		iterator->stack[iterator->depth++] = node;
+	return out;
+}
+
+/* get next node from iterator without changing its state */
+avl_lean_node_t *avl_lean_peek_impl(avl_lean_iterator_t *iterator) {
+	return (iterator->depth == 0) ? NULL : iterator->stack[iterator->depth - 1];
+}
+
+/* records a violation in the report and returns -1 to be passed up as the subtree height */
+static int lean_verify_fail(avl_lean_root_t *root, avl_report_t *report, avl_violation_t violation,
+			    avl_lean_node_t *node) {
+	report->violation = violation;
+	report->item = AVL_LEAN_UPCAST(node, root->offset);
+	return -1;
+}
+
+/* verifies a subtree of a lean tree and returns its height or -1 if it is broken
+ * prev points to the last node visited in-order, which has to be lower than node */
+static int lean_verify_subtree(avl_lean_root_t *root, avl_report_t *report, avl_lean_node_t *node,
+			       avl_lean_node_t **prev, int depth) {
+	if (node == NULL)
+		return 0;
+	if (depth > AVL_MAX_HEIGHT)
+		return lean_verify_fail(root, report, AVL_BROKEN_DEPTH, node);
+
+	int lheight = lean_verify_subtree(root, report, node->sons[left], prev, depth + 1);
+	if (lheight < 0)
+		return -1;
+
+	if (*prev != NULL && compare_lean(root, *prev, node) >= 0)
+		return lean_verify_fail(root, report, AVL_BROKEN_ORDER, node);
+	*prev = node;
+
+	int rheight = lean_verify_subtree(root, report, node->sons[right], prev, depth + 1);
+	if (rheight < 0)
+		return -1;
+
+	if (ABS(rheight - lheight) > 1)
+		return lean_verify_fail(root, report, AVL_BROKEN_BALANCE, node);
+	if (node->sign != rheight - lheight)
+		return lean_verify_fail(root, report, AVL_BROKEN_SIGN, node);
+
+	++report->signs[node->sign + 1];
+	++report->count;
+	return MAX(lheight, rheight) + 1;
+}
+
+/* check all invariants of a lean tree and return true if it is valid */
+bool avl_lean_verify_impl(avl_lean_root_t *root, avl_report_t *report) {
+	avl_lean_node_t *prev = NULL;
+	*report = (avl_report_t){ .violation = AVL_VALID };
+	report->height = lean_verify_subtree(root, report, root->root_node, &prev, 1);
+	return report->violation == AVL_VALID;
+}
+
+/* --- VERIFICATION ------------------------------------------- */
+
+/* records a violation and returns -1 to be passed up as the subtree height */
+static int verify_fail(verify_ctx_t *ctx, verify_task_t *task, avl_violation_t violation, avl_node_t *node) {
+	if (task->violation == AVL_VALID) {
+		task->violation = violation;
+		task->culprit = node;
+	}
+	atomic_store_explicit(&ctx->failed, true, memory_order_relaxed);
+	return -1;
+}
+
+/* checks the balance of node whose subtrees are of the given heights, counts
+ * the node in the report and returns the height of its subtree or -1 */
+static int verify_balance(verify_ctx_t *ctx, verify_task_t *task, avl_node_t *node, int lheight, int rheight) {
+	int imbalance;
+	if (ctx->root->policy == AVL_POLICY_WAVL) {
+		/* rank differences have to be 1 or 2 and leaves have to be of rank 0 */
+		avl_node_t *rson = (node->sons[right] == ctx->thread) ? NULL : node->sons[right];
+		int lrank = rank(node->sons[left]), rrank = rank(rson);
+		if (node->rank - lrank < 1 || node->rank - lrank > 2 || node->rank - rrank < 1 || node->rank - rrank > 2
+		    || (node->sons[left] == NULL && rson == NULL && node->rank != 0))
+			return verify_fail(ctx, task, AVL_BROKEN_SIGN, node);
+		imbalance = rrank - lrank;
+	} else {
+		if (ABS(rheight - lheight) > 1)
+			return verify_fail(ctx, task, AVL_BROKEN_BALANCE, node);
+		if (node->sign != rheight - lheight)
+			return verify_fail(ctx, task, AVL_BROKEN_SIGN, node);
+		imbalance = node->sign;
+	}
+
+	if (ctx->root->interval && interval(node)->max != compute_max(node))
+		return verify_fail(ctx, task, AVL_BROKEN_MAX, node);
+
+	++task->signs[imbalance + 1];
+	++task->count;
+	task->tombstones += node->deleted;
+	return MAX(lheight, rheight) + 1;
+}
+
+/* verifies a subtree and returns its height or -1 if it is broken
+ * prev points to the last node visited in-order, which has to be lower than node */
+static int verify_subtree(verify_ctx_t *ctx, verify_task_t *task, avl_node_t *node, avl_node_t *father,
+			  avl_node_t **prev, int depth) {
+	if (node == NULL || node == ctx->thread)
+		return 0;
+	if (atomic_load_explicit(&ctx->failed, memory_order_relaxed))
+		return -1;
+	if (depth > AVL_MAX_HEIGHT)
+		return verify_fail(ctx, task, AVL_BROKEN_DEPTH, node);
+	if (node->father != father)
+		return verify_fail(ctx, task, AVL_BROKEN_FATHER, node);
+
+	int lheight = verify_subtree(ctx, task, node->sons[left], node, prev, depth + 1);
+	if (lheight < 0)
+		return -1;
+
+	if (*prev != NULL && compare_nodes(ctx->root, *prev, node) >= 0)
+		return verify_fail(ctx, task, AVL_BROKEN_ORDER, node);
+	*prev = node;
+
+	int rheight = verify_subtree(ctx, task, node->sons[right], node, prev, depth + 1);
+	if (rheight < 0)
+		return -1;
+
+	return verify_balance(ctx, task, node, lheight, rheight);
+}
+
+/* verifies the threaded parts of a pass of avl_rebuild_step_impl in order
+ * without touching them and returns the height of the highest one or -1 - the
+ * nodes on the stack of the part being built are checked for their left
+ * subtree, father, order and max endpoint, their right son is the thread */
+static int verify_rebuild(verify_ctx_t *ctx, verify_task_t *task, struct avl_rebuild *rb) {
+	avl_node_t *prev = NULL, *father = NULL;
+	int height = 0;
+	if (rb->lower != NULL) {
+		ctx->thread = rb->lower_tail->sons[right];
+		height = verify_subtree(ctx, task, rb->lower, NULL, &prev, 1);
+		father = rb->lower_tail;
+	}
+	ctx->thread = NULL;
+	for (int i = 0; i < rb->build.depth && height >= 0; ++i) {
+		avl_node_t *node = rb->build.stack[i].node;
+		if (node->father != father)
+			return verify_fail(ctx, task, AVL_BROKEN_FATHER, node);
+		int lheight = verify_subtree(ctx, task, node->sons[left], node, &prev, 2);
+		if (lheight < 0)
+			return -1;
+		if (lheight != rb->build.stack[i].height)
+			return verify_fail(ctx, task, AVL_BROKEN_BALANCE, node);
+		if (prev != NULL && compare_nodes(ctx->root, prev, node) >= 0)
+			return verify_fail(ctx, task, AVL_BROKEN_ORDER, node);
+		if (ctx->root->interval && interval(node)->max != compute_max(node))
+			return verify_fail(ctx, task, AVL_BROKEN_MAX, node);
+		prev = node;
+		father = node;
+		++task->count;
+		task->tombstones += node->deleted;
+		height = MAX(height, lheight + 1);
+	}
+	if (height < 0)
+		return -1;
+
+	if (rb->build.carry != NULL) {
+		ctx->thread = rb->carry_tail->sons[right];
+		int carry_height = verify_subtree(ctx, task, rb->build.carry, father, &prev, 1);
+		ctx->thread = NULL;
+		if (carry_height < 0)
+			return -1;
+		if (carry_height != rb->build.carry_height)
+			return verify_fail(ctx, task, AVL_BROKEN_BALANCE, rb->build.carry);
+		father = rb->carry_tail;
+		height = MAX(height, carry_height);
+	}
+	int upper_height = verify_subtree(ctx, task, rb->upper, father, &prev, 1);
+	if (upper_height < 0)
+		return -1;
+	return MAX(height, upper_height);
+}
+
+/* verifies a task subtree including the bounds given by its in-order neighbours */
+static void verify_task(verify_ctx_t *ctx, verify_task_t *task) {
+	avl_node_t *prev = task->lower;
+	task->height = verify_subtree(ctx, task, task->node, task->father, &prev, task->depth);
+	if (task->height >= 0 && task->upper != NULL && compare_nodes(ctx->root, prev, task->upper) >= 0)
+		task->height = verify_fail(ctx, task, AVL_BROKEN_ORDER, prev);
+}
+
+static void *verify_worker(void *arg) {
+	verify_ctx_t *ctx = arg;
+	size_t i;
+	while ((i = atomic_fetch_add(&ctx->next_task, 1)) < ctx->tasks_count)
+		verify_task(ctx, &ctx->tasks[i]);
+	return NULL;
+}
+
+/* walks the nodes above split_depth and collects the subtrees below them as tasks
+ * the nodes above are only checked later by verify_top */
+static void collect_tasks(verify_ctx_t *ctx, avl_node_t *node, avl_node_t *father, avl_node_t *lower,
+			  avl_node_t *upper, int depth, int split_depth) {
+	if (node == NULL)
+		return;
+	if (depth == split_depth) {
+		ctx->tasks[ctx->tasks_count++] = (verify_task_t){
+			.node = node, .father = father, .lower = lower, .upper = upper, .depth = depth + 1
+		};
+		return;
+	}
+	collect_tasks(ctx, node->sons[left], node, lower, node, depth + 1, split_depth);
+	collect_tasks(ctx, node->sons[right], node, node, upper, depth + 1, split_depth);
+}
+
+/* verifies the nodes above split_depth and merges the results of the tasks below
+ * them - visits the tasks in the same order as collect_tasks */
+static int verify_top(verify_ctx_t *ctx, verify_task_t *top, size_t *next_task, avl_node_t *node,
+		      avl_node_t *father, avl_node_t *lower, avl_node_t *upper, int depth, int split_depth) {
+	if (node == NULL)
+		return 0;
+	if (depth == split_depth) {
+		verify_task_t *task = &ctx->tasks[(*next_task)++];
+		if (task->violation != AVL_VALID && top->violation == AVL_VALID) {
+			top->violation = task->violation;
+			top->culprit = task->culprit;
+		}
+		top->count += task->count;
+		top->tombstones += task->tombstones;
+		for (int i = 0; i < 3; ++i)
+			top->signs[i] += task->signs[i];
+		return task->height;
+	}
+
+	if (node->father != father)
+		return verify_fail(ctx, top, AVL_BROKEN_FATHER, node);
+	if ((lower != NULL && compare_nodes(ctx->root, lower, node) >= 0)
+		|| (upper != NULL && compare_nodes(ctx->root, node, upper) >= 0))
+		return verify_fail(ctx, top, AVL_BROKEN_ORDER, node);
+
+	int lheight = verify_top(ctx, top, next_task, node->sons[left], node, lower, node, depth + 1, split_depth);
+	int rheight = verify_top(ctx, top, next_task, node->sons[right], node, node, upper, depth + 1, split_depth);
+	if (lheight < 0 || rheight < 0)
+		return -1;
+
+	return verify_balance(ctx, top, node, lheight, rheight);
+}
+
+/* runs the tasks on threads - 1 helper threads and the calling thread */
+static void run_tasks(verify_ctx_t *ctx, unsigned threads) {
+	pthread_t *helpers = malloc(threads * sizeof(pthread_t));
+	unsigned started = 0;
+	if (helpers != NULL)
+		while (started + 1 < threads && pthread_create(&helpers[started], NULL, verify_worker, ctx) == 0)
+			++started;
+
+	verify_worker(ctx);
+	for (unsigned i = 0; i < started; ++i)
+		pthread_join(helpers[i], NULL);
+	free(helpers);
+}
+
+/* returns the height of the leftmost path, which is within a factor of two of the tree height */
+static int leftmost_height(avl_node_t *node) {
+	int height = 0;
+	for (; node != NULL && height <= AVL_MAX_HEIGHT; node = node->sons[left])
+		++height;
+	return height;
+}
+
+/* check all invariants of the tree and return true if it is valid */
+bool avl_verify_impl(avl_root_t *root, avl_report_t *report, unsigned threads) {
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 0) ? cpus : 1;
+	}
+
+	verify_ctx_t ctx = { .root = root };
+	verify_task_t result = {0};
+	int split_depth = 0;
+	if (threads > 1 && root->rebuild == NULL && leftmost_height(root->root_node) >= VERIFY_PARALLEL_MIN_HEIGHT) {
+		while ((1ul << split_depth) < (unsigned long)threads * VERIFY_TASKS_PER_THREAD)
+			++split_depth;
+		ctx.tasks = malloc((1ul << split_depth) * sizeof(verify_task_t));
+	}
+
+	if (ctx.tasks != NULL) {
+		collect_tasks(&ctx, root->root_node, NULL, NULL, NULL, 0, split_depth);
+		run_tasks(&ctx, threads);
+		size_t next_task = 0;
+		result.height = verify_top(&ctx, &result, &next_task, root->root_node, NULL, NULL, NULL, 0, split_depth);
+		free(ctx.tasks);
+	} else if (root->rebuild != NULL) {
+		result.height = verify_rebuild(&ctx, &result, root->rebuild);
+	} else {
+		avl_node_t *prev = NULL;
+		result.height = verify_subtree(&ctx, &result, root->root_node, NULL, &prev, 1);
+	}
+
+	/* only a valid tree is sure to have a rightmost node */
+	if (result.violation == AVL_VALID
+	    && root->max_node != ((root->root_node == NULL) ? NULL : *minmax_of_tree(&root->root_node, AVL_MAX))) {
+		result.violation = AVL_BROKEN_ROOT;
+		result.culprit = root->max_node;
+	}
+	if (result.violation == AVL_VALID && (root->count != result.count || root->tombstones != result.tombstones))
+		result.violation = AVL_BROKEN_ROOT;
+
+	*report = (avl_report_t){
+		.violation = result.violation,
+		.item = AVL_UPCAST(result.culprit, root->offset),
+		.height = result.height,
+		.count = result.count,
+		.tombstones = result.tombstones,
+		.signs = { result.signs[0], result.signs[1], result.signs[2] }
+	};
+	return result.violation == AVL_VALID;
+}
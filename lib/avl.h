@@ -4,16 +4,51 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* --- TYPES -------------------------------------------------- */
 
+/* an upper bound on the height of any tree which fits into memory, which sizes
+ * the fixed stacks of paths from the root - for n < 2^64 nodes an AVL tree is
+ * at most 1.44 log2 n < 93 and a WAVL tree at most 2 log2 n <= 128 levels high */
+#define AVL_MAX_HEIGHT	128
+
 /* internal structure storing the information necessary for proper function of the
  * AVL tree data structure */
 typedef struct avl_node {
 	struct avl_node *sons[2]; // { left_son, right_son }
 	struct avl_node *father;
-	int sign; // right subtree depth - left subtree depth
+	union {
+		int sign; // right subtree depth - left subtree depth (AVL_POLICY_AVL)
+		int rank; // rank of the node (AVL_POLICY_WAVL)
+	};
+	bool deleted; // tombstone left by avl_mark_deleted
 } avl_node_t;
 
+/* node of a tree in interval mode - the items are ordered by low endpoints and
+ * every node keeps the maximal high endpoint of its subtree so that overlap
+ * queries can skip whole subtrees */
+typedef struct {
+	avl_node_t node; // has to be the first member
+	long low, high;  // closed interval [low, high] set by the user before insertion
+	long max;        // maximal high endpoint in the subtree (internal)
+} avl_interval_node_t;
+
+/* node of a lean tree, which has no father pointers - operations on lean trees
+ * remember the path from the root on a stack instead */
+typedef struct avl_lean_node {
+	struct avl_lean_node *sons[2]; // { left_son, right_son }
+	int sign;                      // right subtree depth - left subtree depth
+} avl_lean_node_t;
+
+/* rules by which the tree is kept balanced */
+typedef enum {
+	AVL_POLICY_AVL,  // the lowest trees, a delete may rotate all the way up to the root
+	AVL_POLICY_WAVL, // weak AVL - at most two rotations per insert or delete
+} avl_policy_t;
+
 /* A comparator function intended for structs wrapping avl_node. Arguments are
  * expected to be non-null.
  *
@@ -29,19 +64,108 @@ typedef int (*avl_comparator_t)(const void *item1, const void *item2) __attribut
 typedef int (*avl_comparator_t)(const void *item1, const void *item2);
 #endif
 
+/* callbacks of avl_serialize and avl_deserialize, ctx is passed through to them
+ *
+ * avl_encode_fn stores the encoding of item into buf of given size and returns
+ * the length of the encoding - if it is larger than size it is called again
+ * with a larger buffer
+ * avl_write_fn writes size bytes of data and returns 0 on success
+ * avl_read_fn reads exactly size bytes into data and returns 0 on success
+ * avl_decode_fn returns a new item decoded from size bytes of data or NULL
+ */
+typedef size_t (*avl_encode_fn)(void *ctx, const void *item, void *buf, size_t size);
+typedef int (*avl_write_fn)(void *ctx, const void *data, size_t size);
+typedef int (*avl_read_fn)(void *ctx, void *data, size_t size);
+typedef void *(*avl_decode_fn)(void *ctx, const void *data, size_t size);
+
+/* callback of avl_purge, avl_rebuild_step and avl_deserialize which takes over
+ * an item no longer in the tree or never linked into it */
+typedef void (*avl_release_fn)(void *ctx, void *item);
+
+/* order in which avl_rebuild_step lays the items out in the buffer of a layout */
+typedef enum {
+	AVL_LAYOUT_INORDER, // the items follow each other in order
+	AVL_LAYOUT_VEB,     // van Emde Boas order - subtrees of half the height are contiguous, recursively
+} avl_layout_order_t;
+
+/* buffer avl_rebuild_step moves the items into - the old copies are handed
+ * over to release once the tree no longer refers to them
+ * the items which don't get a slot aren't moved, in the van Emde Boas order
+ * those are the ones outside of the highest perfect tree fitting into the
+ * buffer, so it takes 2^h - 1 items for a tree of height h to move them all */
+typedef struct {
+	void *buffer;
+	size_t capacity; // number of items the buffer has room for
+	avl_layout_order_t order;
+	avl_release_fn release;
+	void *ctx;
+} avl_layout_t;
+
 /* internal structure representing root of the AVL tree */
 typedef struct {
 	avl_node_t *root_node;
+	avl_node_t *max_node; // maximal node kept for appends and avl_max
 	avl_comparator_t cmp;
 	size_t offset; // offset from avl_node to its wrapper struct
+	avl_policy_t policy;
+	bool interval; // nodes are avl_interval_node_t and their max endpoints are maintained
+	size_t count;  // number of nodes in the tree including tombstones
+	size_t tombstones; // number of nodes marked deleted
+	avl_node_t *purge_cursor; // node the next incremental avl_purge starts from
+	struct avl_rebuild *rebuild; // pass of avl_rebuild_step in progress or NULL
 } avl_root_t;
 
+/* internal structure representing root of a lean AVL tree - lean trees are
+ * always balanced by AVL_POLICY_AVL and don't support the interval mode */
+typedef struct {
+	avl_lean_node_t *root_node;
+	avl_comparator_t cmp;
+	size_t offset; // offset from avl_lean_node to its wrapper struct
+} avl_lean_root_t;
+
 typedef struct {
 	avl_node_t *cur, *end;
 	avl_root_t *root;
 	bool low_to_high;
 } avl_iterator_t;
 
+/* iterator over the items of an interval tree overlapping [low, high] */
+typedef struct {
+	avl_node_t *cur;
+	long low, high;
+} avl_overlap_iterator_t;
+
+/* iterator over a lean tree - it carries the nodes whose turn is yet to come on
+ * the path to the current node */
+typedef struct {
+	avl_lean_node_t *stack[AVL_MAX_HEIGHT];
+	int depth;
+	avl_lean_node_t *end;
+	bool low_to_high;
+} avl_lean_iterator_t;
+
+/* kinds of broken invariants detected by avl_verify */
+typedef enum {
+	AVL_VALID = 0,
+	AVL_BROKEN_ORDER,   // items aren't ordered according to the comparator function
+	AVL_BROKEN_BALANCE, // heights of the subtrees of a node differ by more than one
+	AVL_BROKEN_SIGN,    // sign or rank of a node doesn't match its subtrees
+	AVL_BROKEN_FATHER,  // father of a node doesn't point back to it
+	AVL_BROKEN_DEPTH,   // the tree is deeper than any valid tree could be - likely a cycle
+	AVL_BROKEN_MAX,     // max endpoint of a node doesn't match its subtree (interval mode)
+	AVL_BROKEN_ROOT,    // information cached in the root doesn't match the tree
+} avl_violation_t;
+
+/* result of avl_verify */
+typedef struct {
+	avl_violation_t violation;
+	void *item;       // item at which the violation was found or NULL if the tree is valid
+	int height;       // height of the tree (only valid for a valid tree)
+	size_t count;     // number of items including tombstones (only valid for a valid tree)
+	size_t tombstones; // number of items marked deleted (only valid for a valid tree)
+	size_t signs[3];  // number of left heavy, balanced and right heavy nodes (by rank under WAVL)
+} avl_report_t;
+
 /* --- CONSTANTS ---------------------------------------------- */
 
 /* optional last argument to avl_get_iterator which determines the iteration order */
@@ -56,6 +180,14 @@ typedef struct {
 #define AVL_NEXT	true
 #define AVL_PREV	false
 
+/* --- STATISTICS --------------------------------------------- */
+
+#ifdef AVL_STATS
+/* total number of rotations carried out by all trees - only maintained if the
+ * library is compiled with AVL_STATS defined */
+extern unsigned long avl_stats_rotations;
+#endif
+
 /* --- INTERNAL FUNCTIONS ------------------------------------- */
 
 /* returns pointer to node with given key or NULL if it wasn't found */
@@ -66,10 +198,68 @@ avl_node_t *avl_find_impl(avl_node_t *key_node, avl_root_t *root);
  * and NULL is returned */
 avl_node_t *avl_insert_impl(avl_node_t *new_node, avl_root_t *root);
 
-/* returns pointer to deleted node or NULL if it wasn't found */
+/* same as avl_insert_impl but the search starts from hint, which has to be a
+ * node of the tree close to the new node, and climbs up only as far as needed */
+avl_node_t *avl_insert_hint_impl(avl_node_t *new_node, avl_node_t *hint, avl_root_t *root);
+
+/* same as avl_find_impl but the search starts from finger, which has to be a
+ * node of the tree close to the key, and climbs up only as far as needed */
+avl_node_t *avl_find_near_impl(avl_node_t *key_node, avl_node_t *finger, avl_root_t *root);
+
+/* marks the node with given key as deleted without changing the shape of the
+ * tree and returns it or NULL if there is no such node which isn't marked yet */
+avl_node_t *avl_mark_deleted_impl(avl_node_t *key_node, avl_root_t *root);
+
+/* removes the nodes marked deleted and passes their items to release - budget
+ * is the number of nodes visited starting where the last call stopped, 0 means
+ * all tombstones are removed at once by rebuilding the tree, returns the number
+ * of tombstones left */
+size_t avl_purge_impl(avl_root_t *root, avl_release_fn release, void *ctx, size_t budget);
+
+/* returns the share of tombstones among the nodes of the tree */
+double avl_tombstone_ratio_impl(avl_root_t *root);
+
+/* rebuilds the tree into the lowest possible one visiting budget nodes per
+ * call, 0 means the whole pass at once, so that the other operations may run
+ * between the calls - a write to the nodes visited so far closes the part
+ * being built, which is then joined to the rest and may leave the result a
+ * level or so higher, the layout given to the call starting a pass is used
+ * for all of it, returns the number of nodes left to visit, 0 once the pass
+ * is over, or SIZE_MAX if out of memory */
+size_t avl_rebuild_step_impl(avl_root_t *root, size_t budget, const avl_layout_t *layout, size_t item_size);
+
+/* ends a pass of avl_rebuild_step_impl early keeping what has been rebuilt */
+void avl_rebuild_stop_impl(avl_root_t *root);
+
+/* returns pointer to deleted node or NULL if it wasn't found - tombstones are
+ * deleted like any other node */
 avl_node_t *avl_delete_impl(avl_node_t *key_node, avl_root_t *root);
 
-/* get minimal or maximal node according to the ordering specified by the comparator function */
+/* links new_node into the tree as the left or right son of father, or as the
+ * root node if father is NULL - the son slot has to be empty and the caller is
+ * responsible for the new node keeping the ordering of the tree */
+void avl_link_impl(avl_node_t *new_node, avl_node_t *father, bool right, avl_root_t *root);
+
+/* removes node, which has to be present in the tree, from the tree */
+void avl_unlink_impl(avl_node_t *node, avl_root_t *root);
+
+/* fixes the links of the tree after the item containing old_node has been
+ * copied to the item containing new_node, which then takes its place */
+void avl_relocate_impl(avl_node_t *old_node, avl_node_t *new_node, avl_root_t *root);
+
+/* writes the items in order as chunks of length prefixed encodings and
+ * returns 0 on success */
+int avl_serialize_impl(avl_root_t *root, avl_encode_fn encode, avl_write_fn write, void *ctx);
+
+/* links the items of a stream written by avl_serialize_impl into an empty tree
+ * at most one level higher than the lowest possible one and returns 0 on success
+ * - on failure the tree holds the items decoded so far and a decoded item which
+ * broke the order is passed to release, which may be NULL */
+int avl_deserialize_impl(avl_root_t *root, avl_read_fn read, avl_decode_fn decode, avl_release_fn release,
+			 void *ctx);
+
+/* get minimal or maximal node according to the ordering specified by the comparator function
+ * or NULL if the tree is empty */
 avl_node_t *avl_minmax_impl(avl_root_t *root, bool max);
 
 /* get previous or next node according to the ordering specified by the comparator function */
@@ -84,6 +274,37 @@ avl_node_t *avl_advance_impl(avl_iterator_t *iterator);
 /* get next node from iterator without changing its state */
 avl_node_t *avl_peek_impl(avl_iterator_t *iterator);
 
+/* get the first item in order which overlaps [low, high] in an interval tree */
+avl_node_t *avl_overlap_first_impl(avl_root_t *root, long low, long high);
+
+/* get new iterator over the items of an interval tree overlapping [low, high] */
+avl_overlap_iterator_t avl_overlap_iterate_impl(avl_root_t *root, long low, long high);
+
+/* get next item from overlap iterator */
+avl_node_t *avl_overlap_advance_impl(avl_overlap_iterator_t *iterator);
+
+/* lean tree counterparts of the functions above */
+avl_lean_node_t *avl_lean_find_impl(avl_lean_node_t *key_node, avl_lean_root_t *root);
+avl_lean_node_t *avl_lean_insert_impl(avl_lean_node_t *new_node, avl_lean_root_t *root);
+avl_lean_node_t *avl_lean_delete_impl(avl_lean_node_t *key_node, avl_lean_root_t *root);
+avl_lean_node_t *avl_lean_minmax_impl(avl_lean_root_t *root, bool max);
+avl_lean_node_t *avl_lean_prevnext_impl(avl_lean_root_t *root, avl_lean_node_t *key_node, bool next);
+avl_lean_iterator_t avl_lean_get_iterator_impl(avl_lean_root_t *root, avl_lean_node_t *lower_bound,
+					       avl_lean_node_t *upper_bound, bool low_to_high);
+avl_lean_node_t *avl_lean_advance_impl(avl_lean_iterator_t *iterator);
+avl_lean_node_t *avl_lean_peek_impl(avl_lean_iterator_t *iterator);
+bool avl_lean_verify_impl(avl_lean_root_t *root, avl_report_t *report);
+
+/* check all invariants of the tree, split the work among threads (0 means
+ * one per online cpu) and return true if the tree is valid - the tree is only
+ * read, though in the middle of a pass of avl_rebuild_step_impl it is checked
+ * by the calling thread alone */
+bool avl_verify_impl(avl_root_t *root, avl_report_t *report, unsigned threads);
+
+#ifdef __cplusplus
+}
+#endif
+
 /* --- INTERNAL MACROS ---------------------------------------- */
 
 /* get number of args in __VA_ARGS__ */
@@ -100,6 +321,13 @@ avl_node_t *avl_peek_impl(avl_iterator_t *iterator);
 		(AVL_UPCAST_safe_ptr__ == NULL) ? NULL : ((void *)AVL_UPCAST_safe_ptr__ - (offset)); \
 	})
 
+/* upcast from avl_lean_node_t member to its wrapper struct */
+#define AVL_LEAN_UPCAST(ptr_to_avl_member, offset) \
+	({ \
+		avl_lean_node_t *AVL_LEAN_UPCAST_safe_ptr__ = (ptr_to_avl_member); \
+		(AVL_LEAN_UPCAST_safe_ptr__ == NULL) ? NULL : ((void *)AVL_LEAN_UPCAST_safe_ptr__ - (offset)); \
+	})
+
 /* downcast from wrapper struct to its avl_node_t member */
 #define AVL_DOWNCAST(ptr_to_wrapper, offset) \
 	({ \
@@ -117,6 +345,16 @@ avl_node_t *avl_peek_impl(avl_iterator_t *iterator);
 			AVL_INVOKE_FUNCTION_safe_root__->avl_root_embed.offset));             \
 	})
 
+/* AVL_INVOKE_FUNCTION for functions with return type avl_lean_node_t* */
+#define AVL_LEAN_INVOKE_FUNCTION(root, func_ptr, ...)                                                   \
+	({                                                                                              \
+		avl_lean_node_t *AVL_LEAN_INVOKE_FUNCTION_avl_func_output__ = (func_ptr)(__VA_ARGS__);  \
+		__auto_type AVL_LEAN_INVOKE_FUNCTION_safe_root__ = (root);                              \
+		(__typeof__(*AVL_LEAN_INVOKE_FUNCTION_safe_root__->node_typeinfo__) *)(AVL_LEAN_UPCAST( \
+			AVL_LEAN_INVOKE_FUNCTION_avl_func_output__,                                     \
+			AVL_LEAN_INVOKE_FUNCTION_safe_root__->avl_root_embed.offset));                  \
+	})
+
 /* --- USER FACING MACROS ------------------------------------- */
 
 /* a shortcut to help user define his root struct */
@@ -126,10 +364,43 @@ avl_node_t *avl_peek_impl(avl_iterator_t *iterator);
 		node_type_name node_typeinfo__[0]; \
 	} root_type_name
 
-/* macro to initialize the user defined root struct */
-#define AVL_NEW(root_type_name, avl_member_name, comparator)                         \
+/* a shortcut to help user define the root struct of a lean tree */
+#define AVL_DEFINE_LEAN_ROOT(root_type_name, node_type_name) \
+	typedef struct { \
+		avl_lean_root_t avl_root_embed; \
+		node_type_name node_typeinfo__[0]; \
+	} root_type_name
+
+/* initializer of the user defined root struct shared by AVL_NEW and AVL_NEW_INTERVAL */
+#define AVL_NEW_ROOT(root_type_name, avl_member_name, comparator, is_interval, ...)  \
 	(root_type_name) {                                                           \
 		.avl_root_embed = (avl_root_t) {                                     \
+			.root_node = NULL, .max_node = NULL, .cmp = (comparator),    \
+			.count = 0, .tombstones = 0, .purge_cursor = NULL,           \
+			.rebuild = NULL,                                             \
+			.offset = AVL_MEMBER_OFFSET(                                 \
+				__typeof__(*((root_type_name *)0)->node_typeinfo__), \
+				avl_member_name),                                    \
+			.policy = (AVL_GET_ARGS_COUNT(__VA_ARGS__) == 1)             \
+					  ? __VA_ARGS__ : AVL_POLICY_AVL,            \
+			.interval = (is_interval)                                    \
+		}                                                                    \
+	}
+
+/* macro to initialize the user defined root struct, the optional last argument
+ * selects the balancing policy */
+#define AVL_NEW(root_type_name, avl_member_name, comparator, ...) \
+	AVL_NEW_ROOT(root_type_name, avl_member_name, comparator, false, __VA_ARGS__)
+
+/* same as AVL_NEW for items with an avl_interval_node_t member, the comparator
+ * has to order the items by their low endpoints first */
+#define AVL_NEW_INTERVAL(root_type_name, avl_member_name, comparator, ...) \
+	AVL_NEW_ROOT(root_type_name, avl_member_name, comparator, true, __VA_ARGS__)
+
+/* macro to initialize the user defined root struct of a lean tree */
+#define AVL_NEW_LEAN(root_type_name, avl_member_name, comparator)                    \
+	(root_type_name) {                                                           \
+		.avl_root_embed = (avl_lean_root_t) {                                \
 			.root_node = NULL, .cmp = (comparator),                      \
 			.offset = AVL_MEMBER_OFFSET(                                 \
 				__typeof__(*((root_type_name *)0)->node_typeinfo__), \
@@ -158,6 +429,30 @@ avl_node_t *avl_peek_impl(avl_iterator_t *iterator);
 				    &avl_insert_safe_root__->avl_root_embed);                \
 	})
 
+#define avl_insert_hint(root, item, hint)                                                          \
+	({                                                                                         \
+		__auto_type avl_insert_hint_safe_root__ = (root);                                  \
+		avl_node_t *avl_insert_hint_safe_node__ =                                          \
+			AVL_DOWNCAST((item), avl_insert_hint_safe_root__->avl_root_embed.offset);  \
+		avl_node_t *avl_insert_hint_safe_hint__ =                                          \
+			AVL_DOWNCAST((hint), avl_insert_hint_safe_root__->avl_root_embed.offset);  \
+		AVL_INVOKE_FUNCTION(avl_insert_hint_safe_root__, avl_insert_hint_impl,             \
+				    avl_insert_hint_safe_node__, avl_insert_hint_safe_hint__,      \
+				    &avl_insert_hint_safe_root__->avl_root_embed);                 \
+	})
+
+#define avl_find_near(root, item, finger)                                                        \
+	({                                                                                       \
+		__auto_type avl_find_near_safe_root__ = (root);                                  \
+		avl_node_t *avl_find_near_safe_node__ =                                          \
+			AVL_DOWNCAST((item), avl_find_near_safe_root__->avl_root_embed.offset);  \
+		avl_node_t *avl_find_near_safe_finger__ =                                        \
+			AVL_DOWNCAST((finger), avl_find_near_safe_root__->avl_root_embed.offset); \
+		AVL_INVOKE_FUNCTION(avl_find_near_safe_root__, avl_find_near_impl,               \
+				    avl_find_near_safe_node__, avl_find_near_safe_finger__,      \
+				    &avl_find_near_safe_root__->avl_root_embed);                 \
+	})
+
 #define avl_delete(root, item)                                                               \
 	({                                                                                   \
 		__auto_type avl_delete_safe_root__ = (root);                                 \
@@ -168,6 +463,37 @@ avl_node_t *avl_peek_impl(avl_iterator_t *iterator);
 				    &avl_delete_safe_root__->avl_root_embed);                \
 	})
 
+#define avl_mark_deleted(root, item)                                                               \
+	({                                                                                         \
+		__auto_type avl_mark_deleted_safe_root__ = (root);                                 \
+		avl_node_t *avl_mark_deleted_safe_node__ =                                         \
+			AVL_DOWNCAST((item), avl_mark_deleted_safe_root__->avl_root_embed.offset); \
+		AVL_INVOKE_FUNCTION(avl_mark_deleted_safe_root__, avl_mark_deleted_impl,           \
+				    avl_mark_deleted_safe_node__,                                  \
+				    &avl_mark_deleted_safe_root__->avl_root_embed);                \
+	})
+
+#define avl_purge(root, release, ctx, ...)                                                     \
+	({                                                                                     \
+		size_t avl_purge_budget__ =                                                    \
+			(AVL_GET_ARGS_COUNT(__VA_ARGS__) == 1) ? __VA_ARGS__ : 0;              \
+		avl_purge_impl(&(root)->avl_root_embed, (release), (ctx), avl_purge_budget__); \
+	})
+
+#define avl_tombstone_ratio(root) avl_tombstone_ratio_impl(&(root)->avl_root_embed)
+
+#define avl_rebuild_step(root, budget, ...)                                                         \
+	({                                                                                          \
+		__auto_type avl_rebuild_step_safe_root__ = (root);                                  \
+		const avl_layout_t *avl_rebuild_step_layouts__[] = { NULL, ##__VA_ARGS__ };         \
+		avl_rebuild_step_impl(&avl_rebuild_step_safe_root__->avl_root_embed, (budget),      \
+				      avl_rebuild_step_layouts__[sizeof(avl_rebuild_step_layouts__) \
+								 / sizeof(void *) - 1],             \
+				      sizeof(*avl_rebuild_step_safe_root__->node_typeinfo__));      \
+	})
+
+#define avl_rebuild_stop(root) avl_rebuild_stop_impl(&(root)->avl_root_embed)
+
 #define avl_contains(root, item)                                                                   \
 	({                                                                                         \
 		__auto_type avl_contains_safe_root__ = (root);                                     \
@@ -230,4 +556,118 @@ avl_node_t *avl_peek_impl(avl_iterator_t *iterator);
 
 #define avl_peek(root, iterator) AVL_INVOKE_FUNCTION((root), avl_peek_impl, (iterator))
 
+#define avl_overlap_first(root, low, high)                                                    \
+	({                                                                                    \
+		__auto_type avl_overlap_first_safe_root__ = (root);                           \
+		AVL_INVOKE_FUNCTION(avl_overlap_first_safe_root__, avl_overlap_first_impl,    \
+				    &avl_overlap_first_safe_root__->avl_root_embed, (low), (high)); \
+	})
+
+#define avl_overlap_iterate(root, low, high) \
+	avl_overlap_iterate_impl(&(root)->avl_root_embed, (low), (high))
+
+#define avl_overlap_advance(root, iterator) AVL_INVOKE_FUNCTION((root), avl_overlap_advance_impl, (iterator))
+
+#define avl_serialize(root, encode, write, ctx) \
+	avl_serialize_impl(&(root)->avl_root_embed, (encode), (write), (ctx))
+
+#define avl_deserialize(root, read, decode, release, ctx) \
+	avl_deserialize_impl(&(root)->avl_root_embed, (read), (decode), (release), (ctx))
+
+#define avl_verify(root, report, ...)                                                      \
+	({                                                                                    \
+		unsigned avl_verify_threads__ =                                               \
+			(AVL_GET_ARGS_COUNT(__VA_ARGS__) == 1) ? __VA_ARGS__ : 0;             \
+		avl_verify_impl(&(root)->avl_root_embed, (report), avl_verify_threads__);     \
+	})
+
+/* lean tree counterparts of the wrappers above */
+
+#define avl_lean_find(root, item)                                                               \
+	({                                                                                      \
+		__auto_type avl_lean_find_safe_root__ = (root);                                 \
+		avl_lean_node_t *avl_lean_find_safe_node__ =                                    \
+			AVL_DOWNCAST((item), avl_lean_find_safe_root__->avl_root_embed.offset); \
+		AVL_LEAN_INVOKE_FUNCTION(avl_lean_find_safe_root__, avl_lean_find_impl,         \
+					 avl_lean_find_safe_node__,                             \
+					 &avl_lean_find_safe_root__->avl_root_embed);           \
+	})
+
+#define avl_lean_insert(root, item)                                                               \
+	({                                                                                        \
+		__auto_type avl_lean_insert_safe_root__ = (root);                                 \
+		avl_lean_node_t *avl_lean_insert_safe_node__ =                                    \
+			AVL_DOWNCAST((item), avl_lean_insert_safe_root__->avl_root_embed.offset); \
+		AVL_LEAN_INVOKE_FUNCTION(avl_lean_insert_safe_root__, avl_lean_insert_impl,       \
+					 avl_lean_insert_safe_node__,                             \
+					 &avl_lean_insert_safe_root__->avl_root_embed);           \
+	})
+
+#define avl_lean_delete(root, item)                                                               \
+	({                                                                                        \
+		__auto_type avl_lean_delete_safe_root__ = (root);                                 \
+		avl_lean_node_t *avl_lean_delete_safe_node__ =                                    \
+			AVL_DOWNCAST((item), avl_lean_delete_safe_root__->avl_root_embed.offset); \
+		AVL_LEAN_INVOKE_FUNCTION(avl_lean_delete_safe_root__, avl_lean_delete_impl,       \
+					 avl_lean_delete_safe_node__,                             \
+					 &avl_lean_delete_safe_root__->avl_root_embed);           \
+	})
+
+#define avl_lean_contains(root, item) (avl_lean_find((root), (item)) != NULL)
+
+#define avl_lean_next(root, item)                                                               \
+	({                                                                                      \
+		__auto_type avl_lean_next_safe_root__ = (root);                                 \
+		avl_lean_node_t *avl_lean_next_safe_node__ =                                    \
+			AVL_DOWNCAST((item), avl_lean_next_safe_root__->avl_root_embed.offset); \
+		AVL_LEAN_INVOKE_FUNCTION(avl_lean_next_safe_root__, avl_lean_prevnext_impl,     \
+					 &avl_lean_next_safe_root__->avl_root_embed,            \
+					 avl_lean_next_safe_node__, AVL_NEXT);                  \
+	})
+
+#define avl_lean_prev(root, item)                                                               \
+	({                                                                                      \
+		__auto_type avl_lean_prev_safe_root__ = (root);                                 \
+		avl_lean_node_t *avl_lean_prev_safe_node__ =                                    \
+			AVL_DOWNCAST((item), avl_lean_prev_safe_root__->avl_root_embed.offset); \
+		AVL_LEAN_INVOKE_FUNCTION(avl_lean_prev_safe_root__, avl_lean_prevnext_impl,     \
+					 &avl_lean_prev_safe_root__->avl_root_embed,            \
+					 avl_lean_prev_safe_node__, AVL_PREV);                  \
+	})
+
+#define avl_lean_min(root)                                                                    \
+	({                                                                                    \
+		__auto_type avl_lean_min_safe_root__ = (root);                                \
+		AVL_LEAN_INVOKE_FUNCTION(avl_lean_min_safe_root__, avl_lean_minmax_impl,      \
+					 &avl_lean_min_safe_root__->avl_root_embed, AVL_MIN); \
+	})
+
+#define avl_lean_max(root)                                                                    \
+	({                                                                                    \
+		__auto_type avl_lean_max_safe_root__ = (root);                                \
+		AVL_LEAN_INVOKE_FUNCTION(avl_lean_max_safe_root__, avl_lean_minmax_impl,      \
+					 &avl_lean_max_safe_root__->avl_root_embed, AVL_MAX); \
+	})
+
+#define avl_lean_get_iterator(root, lower_bound, upper_bound, ...)                                 \
+	({                                                                                         \
+		bool avl_lean_get_iterator_low_to_high__ =                                         \
+			(AVL_GET_ARGS_COUNT(__VA_ARGS__) == 1) ? __VA_ARGS__ : AVL_ASCENDING;      \
+		__auto_type avl_lean_get_iterator_safe_root__ = (root);                            \
+		avl_lean_node_t *avl_lean_get_iterator_safe_lower__ = AVL_DOWNCAST(                \
+			(lower_bound), avl_lean_get_iterator_safe_root__->avl_root_embed.offset);  \
+		avl_lean_node_t *avl_lean_get_iterator_safe_upper__ = AVL_DOWNCAST(                \
+			(upper_bound), avl_lean_get_iterator_safe_root__->avl_root_embed.offset);  \
+		avl_lean_get_iterator_impl(&avl_lean_get_iterator_safe_root__->avl_root_embed,     \
+					   avl_lean_get_iterator_safe_lower__,                     \
+					   avl_lean_get_iterator_safe_upper__,                     \
+					   avl_lean_get_iterator_low_to_high__);                   \
+	})
+
+#define avl_lean_advance(root, iterator) AVL_LEAN_INVOKE_FUNCTION((root), avl_lean_advance_impl, (iterator))
+
+#define avl_lean_peek(root, iterator) AVL_LEAN_INVOKE_FUNCTION((root), avl_lean_peek_impl, (iterator))
+
+#define avl_lean_verify(root, report) avl_lean_verify_impl(&(root)->avl_root_embed, (report))
+
 #endif
@@ -0,0 +1,364 @@
+#ifndef avl_hpp_guard_9c1e5b0a7f3d48e2b6a4c8d1e0f2a3b5c7d9e1f3a5b7c9d1e3f5a7b9c1d3e5f7
+#define avl_hpp_guard_9c1e5b0a7f3d48e2b6a4c8d1e0f2a3b5c7d9e1f3a5b7c9d1e3f5a7b9c1d3e5f7
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#include "avl.h"
+
+/* C++ interface to the library
+ *
+ * avl::tree is an intrusive ordered container in the spirit of std::set. Items
+ * embed an avl_node_t member, which is passed as a template argument together
+ * with the comparator. The comparator is a compile time type so that it can
+ * be inlined into the lookups, which are done entirely in this header. Only
+ * the rebalancing after a structural change is delegated to the C library.
+ *
+ * Like the C interface the tree doesn't manage memory - an item has to outlive
+ * its membership in the tree and can be a member of at most one tree per
+ * avl_node_t member. */
+
+namespace avl {
+
+namespace detail {
+
+/* get previous or next node in order - mirrors prevnext in avl.c */
+inline avl_node_t *prevnext(avl_node_t *node, bool next) {
+	if (node->sons[next] != nullptr) {
+		node = node->sons[next];
+		while (node->sons[!next] != nullptr)
+			node = node->sons[!next];
+		return node;
+	}
+	while (node->father != nullptr && node == node->father->sons[next])
+		node = node->father;
+	return node->father;
+}
+
+/* get minimal or maximal node of a non-empty subtree */
+inline avl_node_t *minmax(avl_node_t *node, bool max) {
+	while (node->sons[max] != nullptr)
+		node = node->sons[max];
+	return node;
+}
+
+} // namespace detail
+
+template <typename T, avl_node_t T::*Member, typename Compare = std::less<T>>
+class tree {
+	template <bool Const>
+	class basic_iterator;
+
+public:
+	using value_type      = T;
+	using key_type        = T;
+	using key_compare     = Compare;
+	using value_compare   = Compare;
+	using size_type       = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using reference       = T &;
+	using const_reference = const T &;
+	using pointer         = T *;
+	using const_pointer   = const T *;
+
+	using iterator               = basic_iterator<false>;
+	using const_iterator         = basic_iterator<true>;
+	using reverse_iterator       = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+	explicit tree(const Compare &comp = Compare(), avl_policy_t policy = AVL_POLICY_AVL)
+		: root_{}, comp_(comp) {
+		root_.policy = policy;
+	}
+
+	/* copying would make two trees share the same nodes */
+	tree(const tree &) = delete;
+	tree &operator=(const tree &) = delete;
+
+	tree(tree &&other) noexcept : root_(other.root_), comp_(std::move(other.comp_)) {
+		other.root_.root_node = other.root_.max_node = other.root_.purge_cursor = nullptr;
+		other.root_.rebuild = nullptr;
+		other.root_.count = other.root_.tombstones = 0;
+	}
+
+	tree &operator=(tree &&other) noexcept {
+		if (this != &other) {
+			avl_rebuild_stop_impl(&root_);
+			root_ = other.root_;
+			comp_ = std::move(other.comp_);
+			other.root_.root_node = other.root_.max_node = other.root_.purge_cursor = nullptr;
+			other.root_.rebuild = nullptr;
+			other.root_.count = other.root_.tombstones = 0;
+		}
+		return *this;
+	}
+
+	/* --- iterators ------------------------------------------------------- */
+
+	iterator begin() noexcept { return iterator(this, first_node()); }
+	const_iterator begin() const noexcept { return cbegin(); }
+	const_iterator cbegin() const noexcept { return const_iterator(this, first_node()); }
+
+	iterator end() noexcept { return iterator(this, nullptr); }
+	const_iterator end() const noexcept { return cend(); }
+	const_iterator cend() const noexcept { return const_iterator(this, nullptr); }
+
+	reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+	const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+	reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+	const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
+
+	/* --- capacity -------------------------------------------------------- */
+
+	bool empty() const noexcept { return root_.root_node == nullptr; }
+	size_type size() const noexcept { return root_.count; }
+
+	/* --- modifiers ------------------------------------------------------- */
+
+	/* unlinks all items at once - the items themselves are left untouched */
+	void clear() noexcept {
+		avl_rebuild_stop_impl(&root_);
+		root_.root_node = root_.max_node = root_.purge_cursor = nullptr;
+		root_.count = root_.tombstones = 0;
+	}
+
+	/* links item into the tree unless an equal item is already present, in which
+	 * case the tree is left unchanged and an iterator to the present item is returned */
+	std::pair<iterator, bool> insert(T &item) {
+		avl_node_t *node = root_.root_node, *father = nullptr;
+		bool right = false;
+		while (node != nullptr) {
+			father = node;
+			if (comp_(item, value(node))) {
+				right = false;
+			} else if (comp_(value(node), item)) {
+				right = true;
+			} else {
+				return {iterator(this, node), false};
+			}
+			node = node->sons[right];
+		}
+		avl_link_impl(&(item.*Member), father, right, &root_);
+		return {iterator(this, &(item.*Member)), true};
+	}
+
+	/* unlinks the item pointed to by pos and returns iterator to the item after it */
+	iterator erase(const_iterator pos) {
+		avl_node_t *next = detail::prevnext(pos.node_, AVL_NEXT);
+		avl_unlink_impl(pos.node_, &root_);
+		return iterator(this, next);
+	}
+
+	/* unlinks the item pointed to by pos */
+	void erase(T &item) { erase(iterator_to(item)); }
+
+	/* unlinks the item equal to key if there is one and returns the number of unlinked items */
+	size_type erase_key(const T &key) { return erase_key_impl(key); }
+
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	size_type erase_key(const K &key) { return erase_key_impl(key); }
+
+	void swap(tree &other) noexcept {
+		using std::swap;
+		swap(root_, other.root_);
+		swap(comp_, other.comp_);
+	}
+
+	/* --- lookup ---------------------------------------------------------- */
+
+	iterator find(const T &key) { return iterator(this, find_node(key)); }
+	const_iterator find(const T &key) const { return const_iterator(this, find_node(key)); }
+
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	iterator find(const K &key) { return iterator(this, find_node(key)); }
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	const_iterator find(const K &key) const { return const_iterator(this, find_node(key)); }
+
+	bool contains(const T &key) const { return find_node(key) != nullptr; }
+
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	bool contains(const K &key) const { return find_node(key) != nullptr; }
+
+	size_type count(const T &key) const { return contains(key); }
+
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	size_type count(const K &key) const { return contains(key); }
+
+	iterator lower_bound(const T &key) { return iterator(this, lower_bound_node(key)); }
+	const_iterator lower_bound(const T &key) const { return const_iterator(this, lower_bound_node(key)); }
+
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	iterator lower_bound(const K &key) { return iterator(this, lower_bound_node(key)); }
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	const_iterator lower_bound(const K &key) const { return const_iterator(this, lower_bound_node(key)); }
+
+	iterator upper_bound(const T &key) { return iterator(this, upper_bound_node(key)); }
+	const_iterator upper_bound(const T &key) const { return const_iterator(this, upper_bound_node(key)); }
+
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	iterator upper_bound(const K &key) { return iterator(this, upper_bound_node(key)); }
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	const_iterator upper_bound(const K &key) const { return const_iterator(this, upper_bound_node(key)); }
+
+	std::pair<iterator, iterator> equal_range(const T &key) { return {lower_bound(key), upper_bound(key)}; }
+	std::pair<const_iterator, const_iterator> equal_range(const T &key) const { return {lower_bound(key), upper_bound(key)}; }
+
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	std::pair<iterator, iterator> equal_range(const K &key) { return {lower_bound(key), upper_bound(key)}; }
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	std::pair<const_iterator, const_iterator> equal_range(const K &key) const { return {lower_bound(key), upper_bound(key)}; }
+
+	/* get iterator to an item which is known to be in the tree in O(1) */
+	iterator iterator_to(T &item) noexcept { return iterator(this, &(item.*Member)); }
+	const_iterator iterator_to(const T &item) const noexcept {
+		return const_iterator(this, const_cast<avl_node_t *>(&(item.*Member)));
+	}
+
+	/* --- observers ------------------------------------------------------- */
+
+	key_compare key_comp() const { return comp_; }
+	value_compare value_comp() const { return comp_; }
+
+private:
+	/* upcast from avl_node_t member to its wrapper item - the C++ counterpart of AVL_UPCAST */
+	static T &value(avl_node_t *node) noexcept {
+		return *reinterpret_cast<T *>(reinterpret_cast<char *>(node) - member_offset());
+	}
+
+	static std::size_t member_offset() noexcept {
+		return reinterpret_cast<std::size_t>(&(static_cast<T *>(nullptr)->*Member));
+	}
+
+	avl_node_t *first_node() const noexcept {
+		return empty() ? nullptr : detail::minmax(root_.root_node, AVL_MIN);
+	}
+
+	template <typename K>
+	avl_node_t *lower_bound_node(const K &key) const {
+		avl_node_t *node = root_.root_node, *out = nullptr;
+		while (node != nullptr) {
+			if (!comp_(value(node), key)) {
+				out = node;
+				node = node->sons[0];
+			} else {
+				node = node->sons[1];
+			}
+		}
+		return out;
+	}
+
+	template <typename K>
+	avl_node_t *upper_bound_node(const K &key) const {
+		avl_node_t *node = root_.root_node, *out = nullptr;
+		while (node != nullptr) {
+			if (comp_(key, value(node))) {
+				out = node;
+				node = node->sons[0];
+			} else {
+				node = node->sons[1];
+			}
+		}
+		return out;
+	}
+
+	template <typename K>
+	avl_node_t *find_node(const K &key) const {
+		avl_node_t *node = root_.root_node;
+		while (node != nullptr) {
+			if (comp_(key, value(node))) {
+				node = node->sons[0];
+			} else if (comp_(value(node), key)) {
+				node = node->sons[1];
+			} else {
+				return node;
+			}
+		}
+		return nullptr;
+	}
+
+	template <typename K>
+	size_type erase_key_impl(const K &key) {
+		avl_node_t *node = find_node(key);
+		if (node == nullptr)
+			return 0;
+		avl_unlink_impl(node, &root_);
+		return 1;
+	}
+
+	/* copied member by member by the moves - the state of a pass of
+	 * avl_rebuild_step owned through rebuild goes along and the moved-from
+	 * tree gives it up, an overwritten or cleared tree ends its pass first */
+	avl_root_t root_;
+	Compare comp_;
+};
+
+/* bidirectional iterator over the items of a tree - a past-the-end iterator
+ * remembers its tree, so that it can be decremented to the maximal item */
+template <typename T, avl_node_t T::*Member, typename Compare>
+template <bool Const>
+class tree<T, Member, Compare>::basic_iterator {
+	friend class tree;
+	using tree_ptr = std::conditional_t<Const, const tree *, tree *>;
+
+public:
+	using iterator_category = std::bidirectional_iterator_tag;
+	using value_type        = T;
+	using difference_type   = std::ptrdiff_t;
+	using pointer           = std::conditional_t<Const, const T *, T *>;
+	using reference         = std::conditional_t<Const, const T &, T &>;
+
+	basic_iterator() noexcept : tree_(nullptr), node_(nullptr) {}
+
+	/* iterator -> const_iterator conversion */
+	template <bool C = Const, typename = std::enable_if_t<C>>
+	basic_iterator(const basic_iterator<false> &other) noexcept : tree_(other.tree_), node_(other.node_) {}
+
+	reference operator*() const noexcept { return value(node_); }
+	pointer operator->() const noexcept { return &value(node_); }
+
+	basic_iterator &operator++() noexcept {
+		node_ = detail::prevnext(node_, AVL_NEXT);
+		return *this;
+	}
+
+	basic_iterator &operator--() noexcept {
+		node_ = (node_ == nullptr) ? tree_->root_.max_node
+					   : detail::prevnext(node_, AVL_PREV);
+		return *this;
+	}
+
+	basic_iterator operator++(int) noexcept {
+		basic_iterator out = *this;
+		++*this;
+		return out;
+	}
+
+	basic_iterator operator--(int) noexcept {
+		basic_iterator out = *this;
+		--*this;
+		return out;
+	}
+
+	friend bool operator==(const basic_iterator &a, const basic_iterator &b) noexcept { return a.node_ == b.node_; }
+	friend bool operator!=(const basic_iterator &a, const basic_iterator &b) noexcept { return a.node_ != b.node_; }
+
+private:
+	friend class basic_iterator<!Const>;
+
+	basic_iterator(tree_ptr t, avl_node_t *node) noexcept : tree_(t), node_(node) {}
+
+	tree_ptr tree_;
+	avl_node_t *node_;
+};
+
+template <typename T, avl_node_t T::*Member, typename Compare>
+void swap(tree<T, Member, Compare> &a, tree<T, Member, Compare> &b) noexcept {
+	a.swap(b);
+}
+
+} // namespace avl
+
+#endif
@@ -0,0 +1,334 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl_pool.h"
+
+/* --- CONSTANTS ---------------------------------------------- */
+
+/* number of 64 bit words of the bitmap of used items in a slab */
+#define SLAB_BITMAP_WORDS	32
+
+/* items are aligned like anything malloc returns */
+#define ITEM_ALIGN		_Alignof(max_align_t)
+
+/* --- TYPES -------------------------------------------------- */
+
+/* slabs are aligned to their size, so that an item can find its slab by masking
+ * its address */
+struct avl_pool_slab {
+	struct avl_pool_slab *next;
+	uint64_t used[SLAB_BITMAP_WORDS]; // a bit per item, set for items handed out to the user
+	_Alignas(ITEM_ALIGN) unsigned char items[];
+};
+
+struct avl_pool_cache {
+	avl_pool_t *pool;
+	struct avl_pool_cache *next, **prev; // list of all caches of the pool
+	size_t count;
+	void *items[AVL_POOL_CACHE_SIZE];
+};
+
+/* --- INTERNAL FUNCTIONS ------------------------------------- */
+
+static struct avl_pool_slab *get_slab(void *item) {
+	return (struct avl_pool_slab *)((uintptr_t)item & ~(uintptr_t)(AVL_POOL_SLAB_SIZE - 1));
+}
+
+static size_t get_index(avl_pool_t *pool, struct avl_pool_slab *slab, void *item) {
+	return ((unsigned char *)item - slab->items) / pool->item_size;
+}
+
+static void *get_item(avl_pool_t *pool, struct avl_pool_slab *slab, size_t index) {
+	return slab->items + index * pool->item_size;
+}
+
+/* set or clear the used bit of an item - atomic as items of a slab may be
+ * allocated and freed by several threads at once */
+static void mark_used(avl_pool_t *pool, void *item, bool used) {
+	struct avl_pool_slab *slab = get_slab(item);
+	size_t index = get_index(pool, slab, item);
+	uint64_t bit = (uint64_t)1 << (index % 64);
+	if (used)
+		__atomic_fetch_or(&slab->used[index / 64], bit, __ATOMIC_RELAXED);
+	else
+		__atomic_fetch_and(&slab->used[index / 64], ~bit, __ATOMIC_RELAXED);
+}
+
+static bool is_used(struct avl_pool_slab *slab, size_t index) {
+	return (slab->used[index / 64] >> (index % 64)) & 1;
+}
+
+static size_t count_used(struct avl_pool_slab *slab) {
+	size_t count = 0;
+	for (size_t i = 0; i < SLAB_BITMAP_WORDS; ++i)
+		count += __builtin_popcountll(slab->used[i]);
+	return count;
+}
+
+static void push_free(avl_pool_t *pool, void *item) {
+	*(void **)item = pool->free_list;
+	pool->free_list = item;
+}
+
+/* adds a new slab with all items free - the lock has to be held */
+static bool add_slab(avl_pool_t *pool) {
+	struct avl_pool_slab *slab = aligned_alloc(AVL_POOL_SLAB_SIZE, AVL_POOL_SLAB_SIZE);
+	if (slab == NULL)
+		return false;
+
+	memset(slab->used, 0, sizeof(slab->used));
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+	++pool->slabs_count;
+
+	/* push in reverse so that items are handed out in address order */
+	for (size_t i = pool->slab_items; i > 0; --i)
+		push_free(pool, get_item(pool, slab, i - 1));
+	return true;
+}
+
+/* takes a free item from the shared free list - the lock has to be held */
+static void *pop_free(avl_pool_t *pool) {
+	if (pool->free_list == NULL && !add_slab(pool))
+		return NULL;
+	void *item = pool->free_list;
+	pool->free_list = *(void **)item;
+	return item;
+}
+
+/* returns count items from the cache back to the shared free list */
+static void flush_cache(struct avl_pool_cache *cache, size_t count) {
+	avl_pool_t *pool = cache->pool;
+	pthread_mutex_lock(&pool->lock);
+	while (count-- > 0)
+		push_free(pool, cache->items[--cache->count]);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* fills half of the cache from the shared free list */
+static void refill_cache(struct avl_pool_cache *cache) {
+	avl_pool_t *pool = cache->pool;
+	pthread_mutex_lock(&pool->lock);
+	void *item;
+	while (cache->count < AVL_POOL_CACHE_SIZE / 2 && (item = pop_free(pool)) != NULL)
+		cache->items[cache->count++] = item;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* destructor of the per-thread cache key, called when a thread exits */
+static void destroy_cache(void *arg) {
+	struct avl_pool_cache *cache = arg;
+	avl_pool_t *pool = cache->pool;
+	pthread_mutex_lock(&pool->lock);
+	while (cache->count > 0)
+		push_free(pool, cache->items[--cache->count]);
+	if (cache->next != NULL)
+		cache->next->prev = cache->prev;
+	*cache->prev = cache->next;
+	pthread_mutex_unlock(&pool->lock);
+	free(cache);
+}
+
+/* returns cache of the calling thread or NULL if it couldn't be created */
+static struct avl_pool_cache *get_cache(avl_pool_t *pool) {
+	struct avl_pool_cache *cache = pthread_getspecific(pool->cache_key);
+	if (cache != NULL)
+		return cache;
+
+	if ((cache = malloc(sizeof(*cache))) == NULL)
+		return NULL;
+	cache->pool = pool;
+	cache->count = 0;
+	if (pthread_setspecific(pool->cache_key, cache) != 0) {
+		free(cache);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	cache->next = pool->caches;
+	cache->prev = &pool->caches;
+	if (pool->caches != NULL)
+		pool->caches->prev = &cache->next;
+	pool->caches = cache;
+	pthread_mutex_unlock(&pool->lock);
+	return cache;
+}
+
+/* orders slabs from the fullest to the emptiest */
+static int compare_slabs(const void *slab1, const void *slab2) {
+	size_t used1 = count_used(*(struct avl_pool_slab **)slab1);
+	size_t used2 = count_used(*(struct avl_pool_slab **)slab2);
+	return (used1 == used2) ? 0
+				: (used1 > used2) ? -1 : +1;
+}
+
+/* returns index of a free item in slab or slab_items if there is none */
+static size_t find_free(avl_pool_t *pool, struct avl_pool_slab *slab) {
+	for (size_t i = 0; i < SLAB_BITMAP_WORDS && i * 64 < pool->slab_items; ++i) {
+		if (~slab->used[i] == 0)
+			continue;
+		size_t index = i * 64 + __builtin_ctzll(~slab->used[i]);
+		return (index < pool->slab_items) ? index : pool->slab_items;
+	}
+	return pool->slab_items;
+}
+
+/* --- PUBLIC FUNCTIONS --------------------------------------- */
+
+/* initialize an empty pool of items of given size - returns 0 on success */
+int avl_pool_init_impl(avl_pool_t *pool, size_t item_size) {
+	*pool = (avl_pool_t){0};
+	if (item_size < sizeof(void *))
+		item_size = sizeof(void *);
+	pool->item_size = (item_size + ITEM_ALIGN - 1) / ITEM_ALIGN * ITEM_ALIGN;
+
+	size_t space = AVL_POOL_SLAB_SIZE - offsetof(struct avl_pool_slab, items);
+	pool->slab_items = space / pool->item_size;
+	if (pool->slab_items > SLAB_BITMAP_WORDS * 64)
+		pool->slab_items = SLAB_BITMAP_WORDS * 64;
+	if (pool->slab_items == 0)
+		return -1;
+
+	if (pthread_key_create(&pool->cache_key, destroy_cache) != 0)
+		return -1;
+	if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+		pthread_key_delete(pool->cache_key);
+		return -1;
+	}
+	return 0;
+}
+
+/* returns a new uninitialized item or NULL if out of memory */
+void *avl_pool_alloc(avl_pool_t *pool) {
+	void *item;
+	struct avl_pool_cache *cache = get_cache(pool);
+	if (cache != NULL) {
+		if (cache->count == 0)
+			refill_cache(cache);
+		item = (cache->count > 0) ? cache->items[--cache->count] : NULL;
+	} else {
+		pthread_mutex_lock(&pool->lock);
+		item = pop_free(pool);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	if (item != NULL)
+		mark_used(pool, item, true);
+	return item;
+}
+
+/* returns an item obtained from avl_pool_alloc back to the pool */
+void avl_pool_free(avl_pool_t *pool, void *item) {
+	if (item == NULL)
+		return;
+
+	mark_used(pool, item, false);
+	struct avl_pool_cache *cache = get_cache(pool);
+	if (cache == NULL) {
+		pthread_mutex_lock(&pool->lock);
+		push_free(pool, item);
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+
+	if (cache->count == AVL_POOL_CACHE_SIZE)
+		flush_cache(cache, AVL_POOL_CACHE_SIZE / 2);
+	cache->items[cache->count++] = item;
+}
+
+/* frees all items at once in O(slabs) - the pool stays usable
+ * no other thread may use the pool meanwhile */
+void avl_pool_release(avl_pool_t *pool) {
+	pthread_mutex_lock(&pool->lock);
+	while (pool->slabs != NULL) {
+		struct avl_pool_slab *next = pool->slabs->next;
+		free(pool->slabs);
+		pool->slabs = next;
+	}
+	pool->slabs_count = 0;
+	pool->free_list = NULL;
+	for (struct avl_pool_cache *cache = pool->caches; cache != NULL; cache = cache->next)
+		cache->count = 0;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* frees all items and all resources held by the pool
+ * no other thread may use the pool meanwhile */
+void avl_pool_destroy(avl_pool_t *pool) {
+	avl_pool_release(pool);
+	pthread_key_delete(pool->cache_key);
+	while (pool->caches != NULL) {
+		struct avl_pool_cache *next = pool->caches->next;
+		free(pool->caches);
+		pool->caches = next;
+	}
+	pthread_mutex_destroy(&pool->lock);
+}
+
+/* move the live items of emptier slabs into the free slots of fuller ones and
+ * free the emptied slabs - returns the number of freed slabs
+ * every live item has to be in the tree and no other thread may use the pool
+ * meanwhile, pointers to moved items are invalidated */
+size_t avl_pool_compact_impl(avl_pool_t *pool, avl_root_t *root) {
+	pthread_mutex_lock(&pool->lock);
+	struct avl_pool_slab **slabs = malloc(pool->slabs_count * sizeof(*slabs));
+	if (slabs == NULL) {
+		pthread_mutex_unlock(&pool->lock);
+		return 0;
+	}
+
+	size_t i = 0;
+	for (struct avl_pool_slab *slab = pool->slabs; slab != NULL; slab = slab->next)
+		slabs[i++] = slab;
+	qsort(slabs, pool->slabs_count, sizeof(*slabs), compare_slabs);
+
+	/* fill the fullest slabs with the items of the emptiest ones */
+	size_t dst = 0, src = pool->slabs_count;
+	while (src-- > dst + 1) {
+		for (size_t index = 0; index < pool->slab_items; ++index) {
+			if (!is_used(slabs[src], index))
+				continue;
+
+			size_t free_index = pool->slab_items;
+			while (dst < src && (free_index = find_free(pool, slabs[dst])) == pool->slab_items)
+				++dst;
+			if (dst == src)
+				break;
+
+			void *old_item = get_item(pool, slabs[src], index);
+			void *new_item = get_item(pool, slabs[dst], free_index);
+			memcpy(new_item, old_item, pool->item_size);
+			avl_relocate_impl((avl_node_t *)((unsigned char *)old_item + root->offset),
+					  (avl_node_t *)((unsigned char *)new_item + root->offset), root);
+			slabs[dst]->used[free_index / 64] |= (uint64_t)1 << (free_index % 64);
+			slabs[src]->used[index / 64] &= ~((uint64_t)1 << (index % 64));
+		}
+	}
+
+	/* free the empty slabs and rebuild the free list from the rest, every
+	 * cached item gets to the free list this way too */
+	size_t freed = 0;
+	pool->slabs = NULL;
+	pool->free_list = NULL;
+	for (i = pool->slabs_count; i > 0; --i) {
+		struct avl_pool_slab *slab = slabs[i - 1];
+		if (count_used(slab) == 0) {
+			free(slab);
+			++freed;
+			continue;
+		}
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+		for (size_t index = pool->slab_items; index > 0; --index)
+			if (!is_used(slab, index - 1))
+				push_free(pool, get_item(pool, slab, index - 1));
+	}
+	pool->slabs_count -= freed;
+	for (struct avl_pool_cache *cache = pool->caches; cache != NULL; cache = cache->next)
+		cache->count = 0;
+
+	pthread_mutex_unlock(&pool->lock);
+	free(slabs);
+	return freed;
+}
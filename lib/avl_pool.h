@@ -0,0 +1,79 @@
+#ifndef avl_pool_guard_5f0b7c2e9a4d4e1b8c3f6a2d9e7b1c4a0f8e3d6b2a5c9e1f7d4b8a2c6e0f3a9d
+#define avl_pool_guard_5f0b7c2e9a4d4e1b8c3f6a2d9e7b1c4a0f8e3d6b2a5c9e1f7d4b8a2c6e0f3a9d
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* An optional companion to the library which hands out fixed-size items of a
+ * dictionary from large slabs. Each thread keeps a small cache of free items,
+ * so that most allocations and frees don't touch any shared state. */
+
+/* --- TYPES -------------------------------------------------- */
+
+/* internal structures of the pool */
+struct avl_pool_slab;
+struct avl_pool_cache;
+
+/* internal structure representing the pool */
+typedef struct {
+	size_t item_size;            // size of an item rounded up to the alignment of items
+	size_t slab_items;           // number of items in a slab
+	pthread_key_t cache_key;     // per-thread caches of free items
+	pthread_mutex_t lock;        // guards all of the following members
+	struct avl_pool_slab *slabs;
+	size_t slabs_count;
+	void *free_list;             // free items which aren't in any cache
+	struct avl_pool_cache *caches;
+} avl_pool_t;
+
+/* --- CONSTANTS ---------------------------------------------- */
+
+/* size and alignment of a slab */
+#define AVL_POOL_SLAB_SIZE	65536
+
+/* maximal number of free items in a thread cache */
+#define AVL_POOL_CACHE_SIZE	64
+
+/* --- INTERNAL FUNCTIONS ------------------------------------- */
+
+/* initialize an empty pool of items of given size - returns 0 on success */
+int avl_pool_init_impl(avl_pool_t *pool, size_t item_size);
+
+/* move the live items of emptier slabs into the free slots of fuller ones and
+ * free the emptied slabs - returns the number of freed slabs */
+size_t avl_pool_compact_impl(avl_pool_t *pool, avl_root_t *root);
+
+/* --- PUBLIC FUNCTIONS --------------------------------------- */
+
+/* returns a new uninitialized item or NULL if out of memory */
+void *avl_pool_alloc(avl_pool_t *pool);
+
+/* returns an item obtained from avl_pool_alloc back to the pool */
+void avl_pool_free(avl_pool_t *pool, void *item);
+
+/* frees all items at once in O(slabs) - the pool stays usable */
+void avl_pool_release(avl_pool_t *pool);
+
+/* frees all items and all resources held by the pool */
+void avl_pool_destroy(avl_pool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* --- USER FACING MACROS ------------------------------------- */
+
+/* initialize pool of items of the dictionary type defined by AVL_DEFINE_ROOT */
+#define avl_pool_init(pool, root_type_name) \
+	avl_pool_init_impl((pool), sizeof(*((root_type_name *)0)->node_typeinfo__))
+
+/* compact pool whose every live item is in the dictionary root */
+#define avl_pool_compact(pool, root) avl_pool_compact_impl((pool), &(root)->avl_root_embed)
+
+#endif
@@ -3,8 +3,10 @@
 #include <time.h>
 #include <limits.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "avl.h"
+#include "avl_pool.h"
 
 /* --- MACROS --------------------------------------- */
 
@@ -16,6 +18,7 @@
 
 #define NODES_COUNT	500000
 #define TEST_REPEAT	10
+#define POOL_THREADS	4
 
 #define THUMBSUP	"\xf0\x9f\x91\x8d"
 #define SADFACE		"\xf0\x9f\x98\xa5"
@@ -32,10 +35,38 @@ typedef struct {
 
 AVL_DEFINE_ROOT(dict_t, dict_item_t);
 
+typedef struct {
+	long id;
+	avl_interval_node_t dict_data;
+} range_item_t;
+
+AVL_DEFINE_ROOT(range_dict_t, range_item_t);
+
+typedef struct {
+	long num;
+	avl_lean_node_t dict_data;
+} lean_item_t;
+
+AVL_DEFINE_LEAN_ROOT(lean_dict_t, lean_item_t);
+
+/* in-memory stream for avl_serialize and avl_deserialize, which also hands out
+ * the items for decoding */
+typedef struct {
+	unsigned char *data;
+	size_t size, capacity, pos;
+	void *items; // array of dict_item_t or range_item_t
+	size_t items_count;
+	size_t released; // number of decoded items avl_deserialize handed back
+} stream_t;
+
 typedef char *(*test_func)(dict_t *, dict_item_t[]);
 
+/* a test which works on items of its own type instead of the shared ones */
+typedef char *(*standalone_test_func)(void);
+
 typedef struct {
 	test_func test;
+	standalone_test_func standalone; // used if test is NULL
 	char *msg;
 	int repeat;
 } testctx_t;
@@ -48,6 +79,100 @@ int comparator(const void *node1, const void *node2) {
 			      : (num1 < num2) ? -1 : +1;
 }
 
+/* orders ranges by their low endpoints and then by ids */
+int range_comparator(const void *item1, const void *item2) {
+	const range_item_t *range1 = item1, *range2 = item2;
+	if (range1->dict_data.low != range2->dict_data.low)
+		return (range1->dict_data.low < range2->dict_data.low) ? -1 : +1;
+	return (range1->id == range2->id) ? 0
+					  : (range1->id < range2->id) ? -1 : +1;
+}
+
+int lean_comparator(const void *node1, const void *node2) {
+	long num1 = ((lean_item_t *)node1)->num, num2 = ((lean_item_t *)node2)->num;
+	return (num1 == num2) ? 0
+			      : (num1 < num2) ? -1 : +1;
+}
+
+int compare_longs(const void *num1, const void *num2) {
+	return (*(long *)num1 > *(long *)num2) - (*(long *)num1 < *(long *)num2);
+}
+
+/* a few items get a long encoding to exercise the growth of the buffers */
+size_t encode_item(void *ctx, const void *item, void *buf, size_t size) {
+	(void)ctx;
+	long num = ((const dict_item_t *)item)->num;
+	size_t needed = sizeof(long) + ((num % 1000 == 0) ? 6000 : 0);
+	if (needed <= size) {
+		memset(buf, 0xab, needed);
+		memcpy(buf, &num, sizeof(long));
+	}
+	return needed;
+}
+
+int write_stream(void *ctx, const void *data, size_t size) {
+	stream_t *stream = ctx;
+	if (stream->size + size > stream->capacity) {
+		stream->capacity = (stream->size + size) * 2;
+		stream->data = realloc(stream->data, stream->capacity);
+		if (stream->data == NULL)
+			return -1;
+	}
+	memcpy(stream->data + stream->size, data, size);
+	stream->size += size;
+	return 0;
+}
+
+int read_stream(void *ctx, void *data, size_t size) {
+	stream_t *stream = ctx;
+	if (stream->pos + size > stream->size)
+		return -1;
+	memcpy(data, stream->data + stream->pos, size);
+	stream->pos += size;
+	return 0;
+}
+
+void *decode_item(void *ctx, const void *data, size_t size) {
+	stream_t *stream = ctx;
+	if (size < sizeof(long))
+		return NULL;
+	dict_item_t *item = &((dict_item_t *)stream->items)[stream->items_count++];
+	memcpy(&item->num, data, sizeof(long));
+	return item;
+}
+
+size_t encode_range(void *ctx, const void *item, void *buf, size_t size) {
+	(void)ctx;
+	const range_item_t *range = item;
+	long fields[] = { range->id, range->dict_data.low, range->dict_data.high };
+	if (sizeof(fields) <= size)
+		memcpy(buf, fields, sizeof(fields));
+	return sizeof(fields);
+}
+
+void *decode_range(void *ctx, const void *data, size_t size) {
+	stream_t *stream = ctx;
+	long fields[3];
+	if (size != sizeof(fields))
+		return NULL;
+	memcpy(fields, data, sizeof(fields));
+	range_item_t *range = &((range_item_t *)stream->items)[stream->items_count++];
+	*range = (range_item_t){ .id = fields[0], .dict_data.low = fields[1], .dict_data.high = fields[2] };
+	return range;
+}
+
+/* counts the decoded items handed back by avl_deserialize */
+void release_decoded(void *ctx, void *item) {
+	(void)item;
+	++((stream_t *)ctx)->released;
+}
+
+/* counts the items released by avl_purge and poisons them */
+void release_item(void *ctx, void *item) {
+	++*(size_t *)ctx;
+	((dict_item_t *)item)->num = -1;
+}
+
 void *safe_malloc(size_t size) {
 	void *memory = malloc(size);
 	if (memory == NULL) {
@@ -274,6 +399,768 @@ char *test_iterator(dict_t *root, dict_item_t nodes[]) {
 	return NULL;
 }
 
+char *test_verify(dict_t *root, dict_item_t nodes[]) {
+	TEST_FAIL_IF(remove_all(root, nodes) != NULL);
+	TEST_FAIL_IF(insert_random(root, nodes) != NULL);
+
+	size_t count = 0;
+	avl_iterator_t iter = avl_get_iterator(root, NULL, NULL);
+	while (avl_advance(root, &iter) != NULL)
+		++count;
+
+	avl_report_t report, single;
+	TEST_FAIL_IF(!avl_verify(root, &report));
+	TEST_FAIL_IF(!avl_verify(root, &report, 4));
+	TEST_FAIL_IF(!avl_verify(root, &single, 1));
+	TEST_FAIL_IF(report.count != count || single.count != count);
+	TEST_FAIL_IF(report.height != single.height || report.height > 1.45 * 19 + 1);
+	TEST_FAIL_IF(report.signs[0] + report.signs[1] + report.signs[2] != count);
+	TEST_FAIL_IF(memcmp(report.signs, single.signs, sizeof(report.signs)) != 0);
+
+	/* break each of the invariants in turn - nodes[0] is somewhere in the tree */
+	dict_item_t *item = avl_find(root, &nodes[0]);
+	avl_node_t *node = &item->dict_data;
+	int sign = node->sign;
+	node->sign = (sign == 0) ? 1 : 0;
+	TEST_FAIL_IF(avl_verify(root, &report, 4));
+	TEST_FAIL_IF(report.violation != AVL_BROKEN_SIGN && report.violation != AVL_BROKEN_BALANCE);
+	TEST_FAIL_IF(avl_verify(root, &report, 1) || report.item == NULL);
+	node->sign = sign;
+
+	avl_node_t *father = node->father;
+	node->father = node;
+	TEST_FAIL_IF(avl_verify(root, &report, 4) || report.violation != AVL_BROKEN_FATHER || report.item != item);
+	node->father = father;
+
+	long num = item->num;
+	item->num = (avl_min(root) == item) ? LONG_MAX : LONG_MIN;
+	TEST_FAIL_IF(avl_verify(root, &report, 4) || report.violation != AVL_BROKEN_ORDER);
+	TEST_FAIL_IF(avl_verify(root, &report, 1) || report.violation != AVL_BROKEN_ORDER);
+	item->num = num;
+
+	TEST_FAIL_IF(!avl_verify(root, &report));
+	return NULL;
+}
+
+char *test_wavl(dict_t *root, dict_item_t nodes[]) {
+	TEST_FAIL_IF(remove_all(root, nodes) != NULL);
+	dict_t wavl = AVL_NEW(dict_t, dict_data, comparator, AVL_POLICY_WAVL);
+	avl_report_t report;
+
+	fill_random(nodes);
+	for (size_t i = 0; i < NODES_COUNT; ++i) {
+		dict_item_t *replaced = avl_insert(&wavl, &nodes[i]);
+		TEST_FAIL_IF(replaced != NULL && comparator(replaced, &nodes[i]) != 0);
+		TEST_FAIL_IF(!avl_contains(&wavl, &nodes[i]));
+	}
+	/* without deletes a WAVL tree is an AVL tree */
+	TEST_FAIL_IF(!avl_verify(&wavl, &report, 1) || report.height > 1.45 * 19 + 1);
+
+	/* replace half of the items by new ones */
+	for (size_t i = 0; i < NODES_COUNT; i += 2) {
+		avl_delete(&wavl, &nodes[i]);
+		TEST_FAIL_IF(avl_contains(&wavl, &nodes[i]));
+		nodes[i].num = random();
+		avl_insert(&wavl, &nodes[i]);
+		TEST_FAIL_IF(!avl_contains(&wavl, &nodes[i]));
+	}
+	TEST_FAIL_IF(!avl_verify(&wavl, &report, 4) || report.height > 2 * 19);
+
+	size_t count = 0;
+	avl_iterator_t iter = avl_get_iterator(&wavl, NULL, NULL);
+	for (dict_item_t *prev = NULL, *cur; (cur = avl_advance(&wavl, &iter)); prev = cur, ++count)
+		TEST_FAIL_IF(prev != NULL && comparator(prev, cur) >= 0);
+	TEST_FAIL_IF(count != report.count);
+
+	for (size_t i = 0; i < NODES_COUNT; ++i) {
+		dict_item_t *deleted = avl_delete(&wavl, &nodes[i]);
+		TEST_FAIL_IF(deleted != NULL && comparator(deleted, &nodes[i]) != 0);
+		TEST_FAIL_IF(avl_contains(&wavl, &nodes[i]));
+		if (i % (NODES_COUNT / 8) == 0)
+			TEST_FAIL_IF(!avl_verify(&wavl, &report, 1));
+	}
+	TEST_FAIL_IF(wavl.avl_root_embed.root_node != NULL);
+	return NULL;
+}
+
+/* allocates and frees items concurrently with other threads, every item is
+ * tagged to catch an item handed out twice */
+void *pool_worker(void *arg) {
+	avl_pool_t *pool = arg;
+	dict_item_t *items[1000];
+	long tag = random();
+	for (int round = 0; round < 50; ++round) {
+		for (size_t i = 0; i < arr_len(items); ++i) {
+			if ((items[i] = avl_pool_alloc(pool)) == NULL)
+				return "allocation failed";
+			items[i]->num = tag + i;
+		}
+		for (size_t i = 0; i < arr_len(items); ++i) {
+			if (items[i]->num != (long)(tag + i))
+				return "item handed out twice";
+			avl_pool_free(pool, items[i]);
+		}
+	}
+	return NULL;
+}
+
+char *test_pool(dict_t *root, dict_item_t nodes[]) {
+	TEST_FAIL_IF(remove_all(root, nodes) != NULL);
+	avl_pool_t pool;
+	TEST_FAIL_IF(avl_pool_init(&pool, dict_t) != 0);
+	dict_t pooled = AVL_NEW(dict_t, dict_data, comparator);
+	avl_report_t report;
+
+	for (size_t i = 0; i < NODES_COUNT / 4; ++i) {
+		dict_item_t *item = avl_pool_alloc(&pool);
+		TEST_FAIL_IF(item == NULL || (size_t)item % _Alignof(max_align_t) != 0);
+		item->num = random();
+		avl_pool_free(&pool, avl_insert(&pooled, item));
+	}
+
+	/* leave holes in every slab */
+	long sum = 0;
+	size_t count = 0;
+	avl_iterator_t iter = avl_get_iterator(&pooled, NULL, NULL);
+	for (dict_item_t *cur, *next = avl_advance(&pooled, &iter); (cur = next); ++count) {
+		next = avl_advance(&pooled, &iter);
+		if (count % 4 != 0) {
+			avl_delete(&pooled, cur);
+			avl_pool_free(&pool, cur);
+		} else {
+			sum += cur->num;
+		}
+	}
+
+	/* the relocations end a rebuild in progress */
+	TEST_FAIL_IF(avl_rebuild_step(&pooled, 1001) == 0);
+	TEST_FAIL_IF(avl_pool_compact(&pool, &pooled) == 0);
+	TEST_FAIL_IF(pooled.avl_root_embed.rebuild != NULL || !avl_verify(&pooled, &report, 1));
+	long sum_after = 0;
+	iter = avl_get_iterator(&pooled, NULL, NULL);
+	for (dict_item_t *cur; (cur = avl_advance(&pooled, &iter));) {
+		sum_after += cur->num;
+		TEST_FAIL_IF(avl_find(&pooled, cur) != cur);
+	}
+	TEST_FAIL_IF(sum != sum_after || report.count != (count + 3) / 4);
+
+	/* compacted pool still hands out and takes back items */
+	for (size_t i = 0; i < NODES_COUNT / 8; ++i) {
+		dict_item_t *item = avl_pool_alloc(&pool);
+		TEST_FAIL_IF(item == NULL);
+		item->num = random();
+		avl_pool_free(&pool, avl_insert(&pooled, item));
+	}
+	TEST_FAIL_IF(!avl_verify(&pooled, &report, 1));
+
+	/* the tree is left dangling, its items go away with their slabs */
+	avl_pool_release(&pool);
+
+	pthread_t threads[POOL_THREADS];
+	for (size_t i = 0; i < arr_len(threads); ++i)
+		TEST_FAIL_IF(pthread_create(&threads[i], NULL, pool_worker, &pool) != 0);
+	char *strerr = NULL;
+	for (size_t i = 0; i < arr_len(threads); ++i) {
+		void *result;
+		pthread_join(threads[i], &result);
+		strerr = (strerr != NULL) ? strerr : result;
+	}
+	avl_pool_destroy(&pool);
+	return strerr;
+}
+
+/* checks the overlap queries for [low, high] against a linear scan of ranges */
+char *check_overlaps(range_dict_t *dict, range_item_t ranges[], size_t count, bool present[], long low,
+		     long high) {
+	range_item_t *first = NULL;
+	size_t expected = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (!present[i] || ranges[i].dict_data.low > high || ranges[i].dict_data.high < low)
+			continue;
+		++expected;
+		if (first == NULL || range_comparator(&ranges[i], first) < 0)
+			first = &ranges[i];
+	}
+	TEST_FAIL_IF(avl_overlap_first(dict, low, high) != first);
+
+	size_t found = 0;
+	avl_overlap_iterator_t iter = avl_overlap_iterate(dict, low, high);
+	for (range_item_t *prev = NULL, *cur; (cur = avl_overlap_advance(dict, &iter)); prev = cur, ++found) {
+		TEST_FAIL_IF(cur->dict_data.low > high || cur->dict_data.high < low);
+		TEST_FAIL_IF(prev != NULL && range_comparator(prev, cur) >= 0);
+	}
+	TEST_FAIL_IF(found != expected);
+	return NULL;
+}
+
+char *test_interval(void) {
+	const size_t count = NODES_COUNT / 10, queries = 200;
+	const long span = count * 100;
+	range_item_t *ranges = safe_malloc(count * sizeof(range_item_t));
+	bool *present = safe_malloc(count * sizeof(bool));
+	range_dict_t dict = AVL_NEW_INTERVAL(range_dict_t, dict_data, range_comparator, random() % 2);
+	avl_report_t report;
+	char *strerr = NULL;
+
+	/* mostly short ranges and a few long ones */
+	for (size_t i = 0; i < count; ++i) {
+		ranges[i].id = i;
+		ranges[i].dict_data.low = random() % span;
+		ranges[i].dict_data.high = ranges[i].dict_data.low + random() % ((i % 100 == 0) ? span / 10 : 1000);
+		present[i] = true;
+		TEST_FAIL_IF(avl_insert(&dict, &ranges[i]) != NULL);
+	}
+	TEST_FAIL_IF(!avl_verify(&dict, &report, 4) || report.count != count);
+
+	for (size_t i = 0; i < queries && strerr == NULL; ++i) {
+		long low = random() % span;
+		strerr = check_overlaps(&dict, ranges, count, present, low, low + random() % 5000);
+	}
+	if (strerr != NULL)
+		return strerr;
+	TEST_FAIL_IF(avl_overlap_first(&dict, 10, 5) != NULL || avl_overlap_first(&dict, span * 2, span * 3) != NULL);
+
+	/* a deserialized copy has its max endpoints set */
+	stream_t stream = { .items = safe_malloc(count * sizeof(range_item_t)) };
+	range_dict_t copy = AVL_NEW_INTERVAL(range_dict_t, dict_data, range_comparator);
+	TEST_FAIL_IF(avl_serialize(&dict, encode_range, write_stream, &stream) != 0);
+	TEST_FAIL_IF(avl_deserialize(&copy, read_stream, decode_range, NULL, &stream) != 0);
+	TEST_FAIL_IF(!avl_verify(&copy, &report, 1) || report.count != count);
+	for (size_t i = 0; i < queries; ++i) {
+		long low = random() % span, high = low + random() % 5000;
+		range_item_t *first = avl_overlap_first(&dict, low, high), *copied = avl_overlap_first(&copy, low, high);
+		TEST_FAIL_IF((first == NULL) != (copied == NULL) || (first != NULL && first->id != copied->id));
+	}
+	free(stream.items);
+	free(stream.data);
+
+	/* delete half of the ranges and widen some of the rest by replacing them */
+	for (size_t i = 0; i < count; i += 2) {
+		TEST_FAIL_IF(avl_delete(&dict, &ranges[i]) != &ranges[i]);
+		present[i] = false;
+	}
+	for (size_t i = 1; i < count; i += 20) {
+		range_item_t *replacement = &ranges[i - 1];
+		*replacement = ranges[i];
+		replacement->dict_data.high += span / 20;
+		TEST_FAIL_IF(avl_insert(&dict, replacement) != &ranges[i]);
+		present[i - 1] = true;
+		present[i] = false;
+	}
+	TEST_FAIL_IF(!avl_verify(&dict, &report, 1));
+
+	for (size_t i = 0; i < queries && strerr == NULL; ++i) {
+		long low = random() % span;
+		strerr = check_overlaps(&dict, ranges, count, present, low, low + random() % 5000);
+	}
+
+	/* tombstones are skipped by the queries and purged step by step */
+	for (size_t i = 1; i < count && strerr == NULL; i += 6) {
+		if (present[i])
+			TEST_FAIL_IF(avl_mark_deleted(&dict, &ranges[i]) != &ranges[i]);
+		present[i] = false;
+	}
+	for (size_t i = 0; i < queries && strerr == NULL; ++i) {
+		long low = random() % span;
+		strerr = check_overlaps(&dict, ranges, count, present, low, low + random() % 5000);
+	}
+	while (avl_purge(&dict, NULL, NULL, 1000) > 0)
+		;
+	TEST_FAIL_IF(!avl_verify(&dict, &report, 1) || report.tombstones != 0);
+
+	/* the queries see the max endpoints of all the parts of a rebuild, while
+	 * ranges come and go between its steps */
+	for (size_t i = 0; avl_rebuild_step(&dict, 1999) > 0 && strerr == NULL; i += 34) {
+		if (i < count && present[i]) {
+			TEST_FAIL_IF(avl_delete(&dict, &ranges[i]) != &ranges[i]);
+			present[i] = false;
+		} else if (i < count && i % 20 != 1) {
+			TEST_FAIL_IF(avl_insert(&dict, &ranges[i]) != NULL);
+			present[i] = true;
+		}
+		long low = random() % span;
+		strerr = check_overlaps(&dict, ranges, count, present, low, low + random() % 5000);
+		TEST_FAIL_IF(!avl_verify(&dict, &report, 1));
+	}
+	TEST_FAIL_IF(!avl_verify(&dict, &report, 1));
+
+	/* a stale max endpoint is reported */
+	if (strerr == NULL && dict.avl_root_embed.root_node != NULL) {
+		avl_interval_node_t *top = (avl_interval_node_t *)dict.avl_root_embed.root_node;
+		++top->max;
+		if (avl_verify(&dict, &report, 1) || report.violation != AVL_BROKEN_MAX)
+			strerr = "ERROR: stale max endpoint not detected";
+		--top->max;
+	}
+
+	free(ranges);
+	free(present);
+	return strerr;
+}
+
+char *test_hint(dict_t *root, dict_item_t nodes[]) {
+	TEST_FAIL_IF(remove_all(root, nodes) != NULL);
+	avl_report_t report;
+
+	/* a nearly sorted stream inserted next to the previous item */
+	dict_item_t *hint = NULL;
+	for (size_t i = 0; i < NODES_COUNT; ++i) {
+		nodes[i].num = i * 4 + random() % 64;
+		dict_item_t *replaced = avl_insert_hint(root, &nodes[i], hint);
+		TEST_FAIL_IF(replaced != NULL && comparator(replaced, &nodes[i]) != 0);
+		/* the previous item may have just been replaced */
+		TEST_FAIL_IF(replaced != hint && avl_find_near(root, &nodes[i], hint) != &nodes[i]);
+		hint = &nodes[i];
+	}
+	TEST_FAIL_IF(!avl_verify(root, &report, 1));
+
+	/* random keys and fingers far apart */
+	for (size_t i = 0; i < NODES_COUNT; i += 2) {
+		dict_item_t *finger = &nodes[random() % NODES_COUNT];
+		if (avl_find(root, finger) != finger)
+			continue;
+		dict_item_t key = { .num = random() % (NODES_COUNT * 4) };
+		TEST_FAIL_IF(avl_find_near(root, &key, finger) != avl_find(root, &key));
+		TEST_FAIL_IF(avl_find_near(root, finger, finger) != finger);
+	}
+	for (size_t i = 0; i < NODES_COUNT; i += 2) {
+		avl_delete(root, &nodes[i]);
+		nodes[i].num = random() % (NODES_COUNT * 4);
+		dict_item_t *finger = (avl_find(root, &nodes[i + 1]) == &nodes[i + 1]) ? &nodes[i + 1] : NULL;
+		dict_item_t *replaced = avl_insert_hint(root, &nodes[i], finger);
+		TEST_FAIL_IF(replaced != NULL && comparator(replaced, &nodes[i]) != 0);
+		TEST_FAIL_IF(!avl_contains(root, &nodes[i]));
+	}
+	TEST_FAIL_IF(!avl_verify(root, &report, 4));
+
+	/* the cached maximum follows deletes of the maximum */
+	for (int i = 0; i < 1000; ++i) {
+		dict_item_t *max = avl_max(root);
+		TEST_FAIL_IF(avl_next(root, max) != NULL || avl_delete(root, max) != max);
+		TEST_FAIL_IF(avl_max(root) == max || comparator(avl_max(root), max) >= 0);
+	}
+	TEST_FAIL_IF(!avl_verify(root, &report, 1));
+
+	/* sequential inserts take the append fast path */
+	TEST_FAIL_IF(remove_all(root, nodes) != NULL);
+	TEST_FAIL_IF(avl_max(root) != NULL || avl_min(root) != NULL);
+	TEST_FAIL_IF(insert_linear(root, nodes) != NULL);
+	TEST_FAIL_IF(!avl_verify(root, &report, 1) || report.count != NODES_COUNT || avl_max(root)->num != NODES_COUNT - 1);
+	root->avl_root_embed.max_node = root->avl_root_embed.root_node;
+	TEST_FAIL_IF(avl_verify(root, &report, 1) || report.violation != AVL_BROKEN_ROOT);
+	root->avl_root_embed.max_node = &avl_max(root)->dict_data;
+	TEST_FAIL_IF(remove_all(root, nodes) != NULL);
+	return NULL;
+}
+
+char *test_serialize(dict_t *root, dict_item_t nodes[]) {
+	TEST_FAIL_IF(remove_all(root, nodes) != NULL);
+	dict_item_t *copies = safe_malloc(NODES_COUNT * sizeof(dict_item_t));
+	avl_report_t report;
+
+	avl_policy_t policies[] = { AVL_POLICY_AVL, AVL_POLICY_WAVL };
+	size_t counts[] = { 0, 1, 2, 3, 7, 1000, NODES_COUNT };
+	for (size_t i = 0; i < arr_len(policies) * arr_len(counts); ++i) {
+		dict_t dict = AVL_NEW(dict_t, dict_data, comparator, policies[i % arr_len(policies)]);
+		size_t count = counts[i / arr_len(policies)];
+		fill_random(nodes);
+		for (size_t j = 0; j < count; ++j)
+			avl_insert(&dict, &nodes[j]);
+		TEST_FAIL_IF(!avl_verify(&dict, &report, 1));
+		size_t present = report.count;
+
+		stream_t stream = { .items = copies };
+		TEST_FAIL_IF(avl_serialize(&dict, encode_item, write_stream, &stream) != 0);
+		dict_t copy = AVL_NEW(dict_t, dict_data, comparator, policies[i % arr_len(policies)]);
+		TEST_FAIL_IF(avl_deserialize(&copy, read_stream, decode_item, NULL, &stream) != 0);
+		TEST_FAIL_IF(stream.pos != stream.size || stream.items_count != present);
+
+		/* at most one level above a perfectly balanced tree */
+		int lowest = 0;
+		while (((size_t)1 << lowest) <= present)
+			++lowest;
+		TEST_FAIL_IF(!avl_verify(&copy, &report, 1) || report.count != present || report.height > lowest + 1);
+
+		avl_iterator_t iter = avl_get_iterator(&dict, NULL, NULL);
+		avl_iterator_t copy_iter = avl_get_iterator(&copy, NULL, NULL);
+		for (size_t j = 0; j < present; ++j)
+			TEST_FAIL_IF(comparator(avl_advance(&dict, &iter), avl_advance(&copy, &copy_iter)) != 0);
+
+		/* the copy keeps working as any other tree */
+		for (size_t j = 0; j < present; j += 2)
+			TEST_FAIL_IF(avl_delete(&copy, &copies[j]) != &copies[j]);
+		TEST_FAIL_IF(!avl_verify(&copy, &report, 1));
+
+		/* a truncated stream and a stream out of order fail */
+		if (present > 2) {
+			dict_t broken = AVL_NEW(dict_t, dict_data, comparator);
+			stream.items_count = stream.pos = 0;
+			stream.size -= 5;
+			TEST_FAIL_IF(avl_deserialize(&broken, read_stream, decode_item, release_decoded, &stream) == 0);
+			TEST_FAIL_IF(!avl_verify(&broken, &report, 1) || report.count != stream.items_count);
+			TEST_FAIL_IF(stream.released != 0);
+
+			broken = AVL_NEW(dict_t, dict_data, comparator);
+			stream.items_count = stream.pos = 0;
+			stream.size += 5;
+			long first = LONG_MAX;
+			memcpy(stream.data + 8, &first, sizeof(long));
+			TEST_FAIL_IF(avl_deserialize(&broken, read_stream, decode_item, release_decoded, &stream) == 0);
+			TEST_FAIL_IF(!avl_verify(&broken, &report, 1) || report.count != 1);
+
+			/* every decoded item is either linked or released */
+			dict_item_t *rejected = &copies[stream.items_count - 1];
+			TEST_FAIL_IF(stream.released != 1 || report.count + stream.released != stream.items_count);
+			TEST_FAIL_IF(avl_find(&broken, rejected) == rejected);
+		}
+		free(stream.data);
+	}
+
+	free(copies);
+	return NULL;
+}
+
+/* checks that the live items of root are exactly the items i of nodes with
+ * num == i for which live(i) holds, in both directions */
+char *check_live(dict_t *root, dict_item_t nodes[], bool (*live)(size_t)) {
+	avl_iterator_t iter = avl_get_iterator(root, NULL, NULL);
+	for (size_t i = 0; i < NODES_COUNT; ++i)
+		if (live(i))
+			TEST_FAIL_IF(avl_advance(root, &iter) != &nodes[i]);
+	TEST_FAIL_IF(avl_advance(root, &iter) != NULL);
+
+	iter = avl_get_iterator(root, NULL, NULL, AVL_DESCENDING);
+	for (size_t i = NODES_COUNT; i-- > 0;)
+		if (live(i))
+			TEST_FAIL_IF(avl_advance(root, &iter) != &nodes[i]);
+	TEST_FAIL_IF(avl_advance(root, &iter) != NULL);
+	return NULL;
+}
+
+/* every third item and the two largest ones are marked deleted */
+bool live_after_marking(size_t i) {
+	return i % 3 != 0 && i < NODES_COUNT - 2;
+}
+
+char *test_tombstones(dict_t *root, dict_item_t nodes[]) {
+	TEST_FAIL_IF(remove_all(root, nodes) != NULL);
+	dict_item_t *copies = safe_malloc(NODES_COUNT * sizeof(dict_item_t));
+	avl_report_t report;
+
+	for (int incremental = 0; incremental < 2; ++incremental) {
+		TEST_FAIL_IF(insert_linear(root, nodes) != NULL);
+		size_t marked = 0;
+		for (size_t i = 0; i < NODES_COUNT; ++i) {
+			if (live_after_marking(i))
+				continue;
+			TEST_FAIL_IF(avl_mark_deleted(root, &nodes[i]) != &nodes[i]);
+			++marked;
+		}
+		TEST_FAIL_IF(avl_mark_deleted(root, &nodes[0]) != NULL);
+		TEST_FAIL_IF(!avl_verify(root, &report, 1) || report.count != NODES_COUNT || report.tombstones != marked);
+		TEST_FAIL_IF(avl_tombstone_ratio(root) != (double)marked / NODES_COUNT);
+
+		/* the tombstones are invisible */
+		for (size_t i = 0; i < NODES_COUNT; ++i)
+			TEST_FAIL_IF(avl_contains(root, &nodes[i]) != live_after_marking(i));
+		TEST_FAIL_IF(check_live(root, nodes, live_after_marking) != NULL);
+		TEST_FAIL_IF(avl_min(root) != &nodes[1] || avl_max(root) != &nodes[NODES_COUNT - 3]);
+		TEST_FAIL_IF(avl_next(root, &nodes[2]) != &nodes[4] || avl_prev(root, &nodes[4]) != &nodes[2]);
+		TEST_FAIL_IF(avl_next(root, &nodes[NODES_COUNT - 3]) != NULL);
+		TEST_FAIL_IF(avl_find_near(root, &nodes[3], &nodes[4]) != NULL);
+		avl_iterator_t iter = avl_get_iterator(root, &nodes[3], &nodes[6]);
+		TEST_FAIL_IF(avl_advance(root, &iter) != &nodes[4] || avl_advance(root, &iter) != &nodes[5]);
+		TEST_FAIL_IF(avl_advance(root, &iter) != NULL);
+		iter = avl_get_iterator(root, &nodes[6], &nodes[6]);
+		TEST_FAIL_IF(avl_peek(root, &iter) != NULL);
+
+		/* only the live items are serialized */
+		stream_t stream = { .items = copies };
+		dict_t copy = AVL_NEW(dict_t, dict_data, comparator);
+		TEST_FAIL_IF(avl_serialize(root, encode_item, write_stream, &stream) != 0);
+		TEST_FAIL_IF(avl_deserialize(&copy, read_stream, decode_item, NULL, &stream) != 0);
+		TEST_FAIL_IF(!avl_verify(&copy, &report, 1) || report.count != NODES_COUNT - marked || report.tombstones != 0);
+		free(stream.data);
+
+		/* tombstones are handed back when replaced or deleted, whatever the
+		 * replacing node contained before */
+		dict_item_t fresh = { .num = 3, .dict_data.deleted = true };
+		TEST_FAIL_IF(avl_insert(root, &fresh) != &nodes[3] || avl_find(root, &fresh) != &fresh);
+		TEST_FAIL_IF(avl_delete(root, &nodes[6]) != &nodes[6] || avl_contains(root, &nodes[6]));
+		marked -= 2;
+		TEST_FAIL_IF(!avl_verify(root, &report, 1) || report.tombstones != marked);
+
+		size_t released = 0, deleted = 0;
+		if (!incremental) {
+			TEST_FAIL_IF(avl_purge(root, release_item, &released) != 0);
+		} else {
+			/* the tree stays usable between the steps, even the item the next
+			 * step starts from may be deleted - new tombstones are only added
+			 * during the first half of a pass so that the purge catches up */
+			for (size_t step = 0; avl_purge(root, release_item, &released, 1000) > 0; ++step) {
+				if (step >= NODES_COUNT / 2000)
+					continue;
+				avl_node_t *cursor = root->avl_root_embed.purge_cursor;
+				dict_item_t *item = (step % 4 == 3 && cursor != NULL)
+							    ? AVL_UPCAST(cursor, root->avl_root_embed.offset)
+							    : &nodes[random() % NODES_COUNT];
+				if (avl_find(root, item) != item)
+					continue;
+				if (step % 2 == 0) {
+					TEST_FAIL_IF(avl_mark_deleted(root, item) != item);
+					++marked;
+				} else {
+					TEST_FAIL_IF(avl_delete(root, item) != item);
+					TEST_FAIL_IF(root->avl_root_embed.purge_cursor == &item->dict_data);
+					++deleted;
+				}
+				if (step % 50 == 0)
+					TEST_FAIL_IF(!avl_verify(root, &report, 1));
+			}
+		}
+
+		size_t poisoned = 0;
+		for (size_t i = 0; i < NODES_COUNT; ++i)
+			poisoned += (nodes[i].num == -1);
+		TEST_FAIL_IF(released != marked || poisoned != marked);
+		TEST_FAIL_IF(!avl_verify(root, &report, 1) || report.tombstones != 0);
+		TEST_FAIL_IF(report.count != NODES_COUNT - 1 - marked - deleted || avl_tombstone_ratio(root) != 0);
+		TEST_FAIL_IF(avl_delete(root, &fresh) != &fresh);
+		TEST_FAIL_IF(remove_all(root, nodes) != NULL);
+	}
+
+	free(copies);
+	return NULL;
+}
+
+/* height of the lowest tree of count nodes */
+int lowest_height(size_t count) {
+	int height = 0;
+	while (((size_t)1 << height) - 1 < count)
+		++height;
+	return height;
+}
+
+/* checks that an iteration yields count items in increasing order */
+char *check_order(dict_t *root, size_t count) {
+	avl_iterator_t iter = avl_get_iterator(root, NULL, NULL);
+	dict_item_t *prev = NULL, *cur;
+	for (; (cur = avl_advance(root, &iter)) != NULL; prev = cur, --count)
+		TEST_FAIL_IF(count == 0 || (prev != NULL && comparator(prev, cur) >= 0));
+	TEST_FAIL_IF(count != 0);
+	return NULL;
+}
+
+char *test_rebuild(dict_t *root, dict_item_t nodes[]) {
+	TEST_FAIL_IF(remove_all(root, nodes) != NULL);
+	dict_item_t *extra = safe_malloc(NODES_COUNT * sizeof(dict_item_t));
+	avl_report_t report;
+
+	for (int policy = AVL_POLICY_AVL; policy <= AVL_POLICY_WAVL; ++policy) {
+		dict_t dict = AVL_NEW(dict_t, dict_data, comparator, policy);
+		fill_random(nodes);
+		for (size_t i = 0; i < NODES_COUNT; ++i)
+			avl_insert(&dict, &nodes[i]);
+		for (size_t i = 0; i < NODES_COUNT; i += 3)
+			avl_delete(&dict, &nodes[i]);
+		TEST_FAIL_IF(!avl_verify(&dict, &report, 1));
+		size_t count = report.count;
+
+		/* the lookups see all the parts between the steps */
+		dict_item_t *min = avl_min(&dict), *max = avl_max(&dict), *second = avl_next(&dict, min);
+		size_t left, steps = 0;
+		while ((left = avl_rebuild_step(&dict, 499)) > 0) {
+			TEST_FAIL_IF(left != count - 499 * ++steps);
+			dict_item_t *item = &nodes[random() % NODES_COUNT], *found = avl_find(&dict, item);
+			TEST_FAIL_IF(found != NULL && comparator(found, item) != 0);
+			TEST_FAIL_IF(avl_min(&dict) != min || avl_max(&dict) != max);
+			TEST_FAIL_IF(avl_next(&dict, min) != second || avl_prev(&dict, second) != min);
+			if (steps % 100 == 0) {
+				TEST_FAIL_IF(!avl_verify(&dict, &report, 1) || report.count != count);
+				TEST_FAIL_IF(check_order(&dict, count) != NULL);
+			}
+		}
+		TEST_FAIL_IF(dict.avl_root_embed.rebuild != NULL);
+		TEST_FAIL_IF(!avl_verify(&dict, &report, 1) || report.count != count);
+		TEST_FAIL_IF(report.height != lowest_height(count));
+
+		/* writes between the steps go to the part of their key, including
+		 * the one being built, and a link looks its place up again */
+		size_t tombstones = 0, used = 0;
+		for (size_t i = 0; i < NODES_COUNT; ++i)
+			extra[i].num = random();
+		for (steps = 0; (left = avl_rebuild_step(&dict, 499)) > 0; ++steps) {
+			TEST_FAIL_IF(left > count);
+			for (int op = 0; op < 6; ++op) {
+				dict_item_t *item = &nodes[random() % NODES_COUNT];
+				if (op == 0 && avl_find(&dict, &extra[used]) == NULL) {
+					avl_link_impl(&extra[used++].dict_data, NULL, false, &dict.avl_root_embed);
+					++count;
+				} else if (op < 3) {
+					dict_item_t *replaced = avl_insert(&dict, &extra[used++]);
+					count += (replaced == NULL);
+					tombstones -= (replaced != NULL && replaced->dict_data.deleted);
+				} else if (op < 5) {
+					dict_item_t *deleted = avl_delete(&dict, item);
+					count -= (deleted != NULL);
+					tombstones -= (deleted != NULL && deleted->dict_data.deleted);
+				} else {
+					tombstones += (avl_mark_deleted(&dict, item) != NULL);
+				}
+			}
+			if (steps % 25 == 0) {
+				TEST_FAIL_IF(!avl_verify(&dict, &report, 1));
+				TEST_FAIL_IF(report.count != count || report.tombstones != tombstones);
+			}
+		}
+		TEST_FAIL_IF(!avl_verify(&dict, &report, 1) || report.count != count || report.tombstones != tombstones);
+		TEST_FAIL_IF(check_order(&dict, count - tombstones) != NULL);
+
+		/* a pass may be ended early, a full purge ends it too */
+		avl_rebuild_step(&dict, 1000);
+		avl_rebuild_stop(&dict);
+		TEST_FAIL_IF(dict.avl_root_embed.rebuild != NULL);
+		TEST_FAIL_IF(!avl_verify(&dict, &report, 1) || report.count != count);
+		avl_rebuild_step(&dict, 1000);
+		TEST_FAIL_IF(avl_purge(&dict, NULL, NULL) != 0);
+		TEST_FAIL_IF(tombstones > 0 && dict.avl_root_embed.rebuild != NULL);
+		avl_rebuild_stop(&dict);
+		TEST_FAIL_IF(!avl_verify(&dict, &report, 1) || report.count != count - tombstones);
+		count -= tombstones;
+
+		/* once a write closed the part being built the next write to its
+		 * maximum goes to lower */
+		dict_item_t *last = avl_min(&dict);
+		for (int i = 1; i < 301; ++i)
+			last = avl_next(&dict, last);
+		avl_rebuild_step(&dict, 301);
+		TEST_FAIL_IF(avl_delete(&dict, avl_min(&dict)) == NULL || avl_delete(&dict, last) != last);
+		count -= 2;
+		TEST_FAIL_IF(!avl_verify(&dict, &report, 1) || report.count != count);
+		avl_rebuild_stop(&dict);
+
+		/* in-order layout - the released old copies are poisoned */
+		dict_item_t *buffer = safe_malloc(count * sizeof(dict_item_t));
+		size_t released = 0;
+		avl_layout_t layout = { buffer, count, AVL_LAYOUT_INORDER, release_item, &released };
+		avl_rebuild_step(&dict, 333, &layout);
+		while (avl_rebuild_step(&dict, 333) > 0)
+			TEST_FAIL_IF(avl_min(&dict) != &buffer[0]);
+		TEST_FAIL_IF(released != count || !avl_verify(&dict, &report, 1) || report.count != count);
+		TEST_FAIL_IF(report.height != lowest_height(count));
+		avl_iterator_t iter = avl_get_iterator(&dict, NULL, NULL);
+		for (size_t i = 0; i < count; ++i)
+			TEST_FAIL_IF(avl_advance(&dict, &iter) != &buffer[i]);
+		free(buffer);
+	}
+
+	/* van Emde Boas layout of the lowest tree - the root comes first followed
+	 * by its sons and a buffer with room for a perfect tree takes every item */
+	const int height = 17;
+	const size_t capacity = ((size_t)1 << height) - 1;
+	dict_item_t *buffer = safe_malloc(capacity * sizeof(dict_item_t));
+	bool *taken = safe_malloc(capacity * sizeof(bool));
+	for (size_t count = capacity; count > capacity / 2; count -= capacity / 5) {
+		dict_t dict = AVL_NEW(dict_t, dict_data, comparator);
+		for (size_t i = 0; i < count; ++i) {
+			nodes[i].num = (i * 7919) % count;
+			TEST_FAIL_IF(avl_insert(&dict, &nodes[i]) != NULL);
+		}
+		memset(taken, 0, capacity * sizeof(bool));
+		size_t released = 0;
+		avl_layout_t layout = { buffer, capacity, AVL_LAYOUT_VEB, release_item, &released };
+		while (avl_rebuild_step(&dict, 401, &layout) > 0)
+			;
+		TEST_FAIL_IF(released != count || !avl_verify(&dict, &report, 1) || report.height != height);
+		avl_node_t *top = dict.avl_root_embed.root_node;
+		TEST_FAIL_IF(top != &buffer[0].dict_data);
+		TEST_FAIL_IF(top->sons[0] != &buffer[1].dict_data || top->sons[1] != &buffer[2].dict_data);
+		avl_iterator_t iter = avl_get_iterator(&dict, NULL, NULL);
+		for (dict_item_t *cur; (cur = avl_advance(&dict, &iter)) != NULL;) {
+			TEST_FAIL_IF(cur < buffer || cur >= buffer + capacity || taken[cur - buffer]);
+			taken[cur - buffer] = true;
+		}
+	}
+
+	free(taken);
+	free(buffer);
+	free(extra);
+	return NULL;
+}
+
+/* checks that a lean iterator yields exactly the items of the sorted array of
+ * distinct nums which lie within [low, high] */
+char *check_lean_range(lean_dict_t *dict, long nums[], size_t count, long low, long high, bool low_to_high) {
+	lean_item_t lower = { .num = low }, upper = { .num = high };
+	avl_lean_iterator_t iter = avl_lean_get_iterator(dict, &lower, &upper, low_to_high);
+	size_t first = 0, last = count;
+	while (first < count && nums[first] < low)
+		++first;
+	while (last > first && nums[last - 1] > high)
+		--last;
+
+	for (size_t i = first; i < last; ++i) {
+		lean_item_t *cur = avl_lean_advance(dict, &iter);
+		TEST_FAIL_IF(cur == NULL || cur->num != nums[low_to_high ? i : last - 1 - (i - first)]);
+	}
+	TEST_FAIL_IF(avl_lean_advance(dict, &iter) != NULL);
+	return NULL;
+}
+
+char *test_lean(void) {
+	lean_item_t *items = safe_malloc(NODES_COUNT * sizeof(lean_item_t));
+	long *nums = safe_malloc(NODES_COUNT * sizeof(long));
+	lean_dict_t dict = AVL_NEW_LEAN(lean_dict_t, dict_data, lean_comparator);
+	avl_report_t report;
+	char *strerr = NULL;
+
+	size_t count = 0;
+	for (size_t i = 0; i < NODES_COUNT; ++i) {
+		items[i].num = random() % (NODES_COUNT * 4);
+		lean_item_t *replaced = avl_lean_insert(&dict, &items[i]);
+		TEST_FAIL_IF(replaced != NULL && replaced->num != items[i].num);
+		TEST_FAIL_IF(avl_lean_find(&dict, &items[i]) != &items[i]);
+		if (replaced == NULL)
+			nums[count++] = items[i].num;
+	}
+	TEST_FAIL_IF(!avl_lean_verify(&dict, &report) || report.count != count || report.height > 1.45 * 19 + 1);
+	qsort(nums, count, sizeof(long), compare_longs);
+
+	TEST_FAIL_IF(avl_lean_min(&dict)->num != nums[0] || avl_lean_max(&dict)->num != nums[count - 1]);
+	for (size_t i = 1; i + 1 < count; i += count / 100) {
+		lean_item_t key = { .num = nums[i] };
+		TEST_FAIL_IF(avl_lean_next(&dict, &key)->num != nums[i + 1]);
+		TEST_FAIL_IF(avl_lean_prev(&dict, &key)->num != nums[i - 1]);
+	}
+
+	for (int i = 0; i < 20 && strerr == NULL; ++i) {
+		long low = random() % (NODES_COUNT * 4), high = low + random() % 1000;
+		strerr = check_lean_range(&dict, nums, count, low, high, i % 2 == 0);
+	}
+	if (strerr == NULL)
+		strerr = check_lean_range(&dict, nums, count, LONG_MIN, LONG_MAX, AVL_ASCENDING);
+	if (strerr == NULL)
+		strerr = check_lean_range(&dict, nums, count, LONG_MIN, LONG_MAX, AVL_DESCENDING);
+	if (strerr != NULL)
+		return strerr;
+	lean_item_t low = { .num = 10 }, high = { .num = 5 };
+	avl_lean_iterator_t iter = avl_lean_get_iterator(&dict, &low, &high);
+	TEST_FAIL_IF(avl_lean_advance(&dict, &iter) != NULL);
+
+	for (size_t i = 0; i < NODES_COUNT; ++i) {
+		lean_item_t *deleted = avl_lean_delete(&dict, &items[i]);
+		TEST_FAIL_IF(deleted != NULL && deleted->num != items[i].num);
+		TEST_FAIL_IF(avl_lean_contains(&dict, &items[i]));
+		if (i % (NODES_COUNT / 8) == 0)
+			TEST_FAIL_IF(!avl_lean_verify(&dict, &report));
+	}
+	TEST_FAIL_IF(dict.avl_root_embed.root_node != NULL);
+
+	free(items);
+	free(nums);
+	return NULL;
+}
+
 /* --- TEST INFRASTRUCUTRE -------------------------- */
 
 int run_test(testctx_t *ctx, dict_t *root, dict_item_t nodes[]) {
@@ -283,7 +1170,8 @@ int run_test(testctx_t *ctx, dict_t *root, dict_item_t nodes[]) {
 		printf("%c%-25s%2d/%d", lasterr ? '\n' : '\r', ctx->msg, i, ctx->repeat);
 		fflush(stdout);
 		lasterr = false;
-		if ((strerr = ctx->test(root, nodes)) != NULL) {
+		strerr = (ctx->test != NULL) ? ctx->test(root, nodes) : ctx->standalone();
+		if (strerr != NULL) {
 			printf(RED("\t%s"), strerr);
 			++err_counter;
 			lasterr = true;
@@ -315,6 +1203,15 @@ int main(void) {
 		{ .test = test_next,     .msg = "next",          .repeat = TEST_REPEAT },
 		{ .test = test_prev,     .msg = "prev",          .repeat = TEST_REPEAT },
 		{ .test = test_iterator, .msg = "iterator",      .repeat = TEST_REPEAT },
+		{ .test = test_verify,   .msg = "verify",        .repeat = TEST_REPEAT },
+		{ .test = test_wavl,     .msg = "wavl",          .repeat = TEST_REPEAT },
+		{ .test = test_pool,     .msg = "pool",          .repeat = TEST_REPEAT },
+		{ .standalone = test_interval, .msg = "interval", .repeat = TEST_REPEAT },
+		{ .standalone = test_lean,     .msg = "lean",     .repeat = TEST_REPEAT },
+		{ .test = test_hint,     .msg = "hint",          .repeat = TEST_REPEAT },
+		{ .test = test_serialize, .msg = "serialize",    .repeat = TEST_REPEAT },
+		{ .test = test_tombstones, .msg = "tombstones",  .repeat = TEST_REPEAT },
+		{ .test = test_rebuild,  .msg = "rebuild",       .repeat = TEST_REPEAT },
 	};
 
 	int err_counter = 0;
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iterator>
+#include <set>
+#include <vector>
+
+#include "avl.hpp"
+
+/* --- MACROS --------------------------------------- */
+
+#define xstr(a) str(a)
+#define str(a) #a
+#define TEST_FAIL_IF(cond) \
+	do { if ((cond)) return "ERROR on line " xstr(__LINE__) " in " __FILE__; } while (0)
+
+#define NODES_COUNT	500000
+#define TEST_REPEAT	3
+
+#define THUMBSUP	"\xf0\x9f\x91\x8d"
+#define SADFACE		"\xf0\x9f\x98\xa5"
+
+#define GREEN(str)	"\033[1;32m" str "\033[0m"
+#define RED(str)	"\033[1;91m" str "\033[0m"
+
+/* --- TYPEDEFS ------------------------------------- */
+
+struct dict_item_t {
+	long num;
+	avl_node_t dict_data;
+};
+
+/* transparent comparator allowing lookups by a plain long */
+struct item_less {
+	using is_transparent = void;
+	bool operator()(const dict_item_t &a, const dict_item_t &b) const { return a.num < b.num; }
+	bool operator()(const dict_item_t &a, long b) const { return a.num < b; }
+	bool operator()(long a, const dict_item_t &b) const { return a < b.num; }
+};
+
+using dict_t = avl::tree<dict_item_t, &dict_item_t::dict_data, item_less>;
+
+typedef const char *(*test_func)(dict_t &, std::vector<dict_item_t> &);
+
+struct testctx_t {
+	test_func test;
+	const char *msg;
+	int repeat;
+};
+
+/* --- TEST FUNCTIONS ------------------------------- */
+
+const char *insert_random(dict_t &dict, std::vector<dict_item_t> &nodes) {
+	dict.clear();
+	std::set<long> reference;
+	for (auto &node : nodes) {
+		node.num = random();
+		bool inserted = dict.insert(node).second;
+		TEST_FAIL_IF(inserted != reference.insert(node.num).second);
+		TEST_FAIL_IF(!dict.contains(node.num));
+	}
+	TEST_FAIL_IF(dict.size() != reference.size());
+	TEST_FAIL_IF(!std::equal(dict.begin(), dict.end(), reference.begin(), reference.end(),
+				 [](const dict_item_t &a, long b) { return a.num == b; }));
+	TEST_FAIL_IF(!std::equal(dict.rbegin(), dict.rend(), reference.rbegin(), reference.rend(),
+				 [](const dict_item_t &a, long b) { return a.num == b; }));
+	return nullptr;
+}
+
+const char *test_erase(dict_t &dict, std::vector<dict_item_t> &nodes) {
+	TEST_FAIL_IF(insert_random(dict, nodes) != nullptr);
+	for (std::size_t i = 0; i < nodes.size(); i += 2)
+		dict.erase_key(nodes[i].num);
+	for (std::size_t i = 0; i < nodes.size(); i += 2)
+		TEST_FAIL_IF(dict.contains(nodes[i].num));
+
+	/* erase the rest through iterators */
+	std::size_t size = dict.size();
+	for (auto it = dict.begin(); it != dict.end(); --size) {
+		auto next = std::next(it);
+		TEST_FAIL_IF(dict.erase(it) != next);
+		it = next;
+	}
+	TEST_FAIL_IF(size != 0 || !dict.empty());
+	return nullptr;
+}
+
+const char *test_bounds(dict_t &dict, std::vector<dict_item_t> &nodes) {
+	dict.clear();
+	for (std::size_t i = 0; i < nodes.size(); ++i) {
+		nodes[i].num = 2 * i;
+		dict.insert(nodes[i]);
+	}
+
+	for (long key = -1; key < 2 * NODES_COUNT; ++key) {
+		auto lower = dict.lower_bound(key);
+		auto upper = dict.upper_bound(key);
+		long expected_lower = (key < 0) ? 0 : key + (key % 2);
+		long expected_upper = (key < 0) ? 0 : key + 2 - (key % 2);
+		TEST_FAIL_IF((expected_lower < 2 * NODES_COUNT) ? lower->num != expected_lower : lower != dict.end());
+		TEST_FAIL_IF((expected_upper < 2 * NODES_COUNT) ? upper->num != expected_upper : upper != dict.end());
+
+		auto range = dict.equal_range(key);
+		TEST_FAIL_IF(std::distance(range.first, range.second) != (key >= 0 && key % 2 == 0));
+	}
+
+	TEST_FAIL_IF(std::prev(dict.end())->num != 2 * (NODES_COUNT - 1));
+	TEST_FAIL_IF(dict.find(1) != dict.end());
+	TEST_FAIL_IF(dict.find(nodes[42]) != dict.iterator_to(nodes[42]));
+	return nullptr;
+}
+
+const char *test_algorithm(dict_t &dict, std::vector<dict_item_t> &nodes) {
+	TEST_FAIL_IF(insert_random(dict, nodes) != nullptr);
+	TEST_FAIL_IF(!std::is_sorted(dict.begin(), dict.end(), item_less()));
+	TEST_FAIL_IF(std::adjacent_find(dict.cbegin(), dict.cend(),
+					[](const dict_item_t &a, const dict_item_t &b) { return a.num == b.num; })
+		     != dict.cend());
+
+	auto found = std::lower_bound(dict.begin(), dict.end(), nodes[0].num, item_less());
+	TEST_FAIL_IF(found == dict.end() || found->num != nodes[0].num);
+
+	dict_t moved(std::move(dict));
+	TEST_FAIL_IF(!dict.empty() || moved.size() == 0);
+	dict = std::move(moved);
+	TEST_FAIL_IF(!dict.contains(nodes[0]));
+	return nullptr;
+}
+
+/* --- TEST INFRASTRUCUTRE -------------------------- */
+
+int run_test(testctx_t *ctx, dict_t &dict, std::vector<dict_item_t> &nodes) {
+	int err_counter = 0, lasterr = 0;
+	const char *strerr = nullptr;
+	for (int i = 1; i <= ctx->repeat; ++i) {
+		printf("%c%-25s%2d/%d", lasterr ? '\n' : '\r', ctx->msg, i, ctx->repeat);
+		fflush(stdout);
+		lasterr = false;
+		if ((strerr = ctx->test(dict, nodes)) != nullptr) {
+			printf(RED("\t%s"), strerr);
+			++err_counter;
+			lasterr = true;
+		}
+	}
+
+	if (err_counter != 0) {
+		printf("%c%-32s%s\n", lasterr ? '\n' : '\r', ctx->msg, RED("FAILED"));
+		fflush(stdout);
+	} else {
+		puts(GREEN("\tOK"));
+	}
+
+	return err_counter;
+}
+
+int main() {
+	srandom(time(nullptr));
+	dict_t dict;
+	std::vector<dict_item_t> nodes(NODES_COUNT);
+
+	testctx_t ctxs[] = {
+		{ insert_random,  "cpp_insert",    TEST_REPEAT },
+		{ test_erase,     "cpp_erase",     TEST_REPEAT },
+		{ test_bounds,    "cpp_bounds",    TEST_REPEAT },
+		{ test_algorithm, "cpp_algorithm", TEST_REPEAT },
+	};
+
+	int err_counter = 0;
+	for (auto &ctx : ctxs)
+		err_counter += run_test(&ctx, dict, nodes);
+
+	if (err_counter == 0) {
+		printf("\nAll C++ tests passed successfully! " THUMBSUP "\n");
+		return 0;
+	} else {
+		printf("\n%d C++ tests failed " SADFACE "\n", err_counter);
+		return 1;
+	}
+}